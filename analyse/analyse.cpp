@@ -0,0 +1,361 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sstream>
+
+#include "blunderfish.h"
+
+// Streams positions from an EPD/FEN file through a pool of searchers and writes one result per line.
+// Results are written as they finish, so their order may differ from the input; the index column says where they came from.
+
+// Clearing the tables before every position is about 7 MB of memset with the engine's 4 MB TT, over 1 ms,
+// which is most of a depth 4 search. A 256 KB TT searches the same nodes to within 1% up to depth 8 and
+// leaves the ~3 MB of histories to clear. --keep-tables skips the clear entirely.
+constexpr int CLEARED_HASH_KB = 256;
+
+enum AnalysisMode {
+    MODE_DEPTH,
+    MODE_NODES,
+    MODE_EVAL
+};
+
+enum OutputFormat {
+    FORMAT_CSV,
+    FORMAT_JSONL
+};
+
+struct Options {
+    std::string input;
+    std::string output;
+    AnalysisMode mode = MODE_DEPTH;
+    int limit = 8;
+    int threads = int(std::max(std::thread::hardware_concurrency(), 1u)); // 0 when unknown
+    OutputFormat format = FORMAT_CSV;
+    bool keep_tables = false; // reuse TT and histories across positions: skips the clear, but results depend on the order
+    int hash_kb = 0;          // TT size per thread, 0 for CLEARED_HASH_KB or the engine's size with keep_tables
+};
+
+struct Job {
+    int64_t index;
+    std::string line;
+};
+
+// Keeps the reader at most a few lines ahead of the searchers, so memory doesn't grow with the input
+template<typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity)
+        : _capacity(capacity)
+    {}
+
+    void push(T item) {
+        std::unique_lock lock(_mutex);
+        _not_full.wait(lock, [&]() { return _items.size() < _capacity; });
+        _items.push_back(std::move(item));
+        _not_empty.notify_one();
+    }
+
+    // returns false once the queue is closed and drained
+    bool pop(T* item) {
+        std::unique_lock lock(_mutex);
+        _not_empty.wait(lock, [&]() { return _closed || !_items.empty(); });
+
+        if (_items.empty()) {
+            return false;
+        }
+
+        *item = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+    }
+
+private:
+    size_t _capacity;
+    std::deque<T> _items;
+    bool _closed = false;
+    std::mutex _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+};
+
+// EPD lines only have the first four FEN fields followed by opcodes, FEN lines have the move counters
+static std::optional<std::string> extract_fen(const std::string& line) {
+    std::istringstream ss(line);
+    std::vector<std::string> fields;
+    std::string field;
+
+    while (fields.size() < 6 && ss >> field) {
+        fields.push_back(field);
+    }
+
+    if (fields.size() < 4) {
+        return std::nullopt;
+    }
+
+    auto is_number = [](const std::string& s) {
+        return !s.empty() && std::all_of(s.begin(), s.end(), [](char c) { return isdigit(c); });
+    };
+
+    std::string fen = fields[0] + " " + fields[1] + " " + fields[2] + " " + fields[3];
+
+    if (fields.size() == 6 && is_number(fields[4]) && is_number(fields[5])) {
+        fen += " " + fields[4] + " " + fields[5];
+    }
+    else {
+        fen += " 0 1";
+    }
+
+    return fen;
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+
+        out += c;
+    }
+
+    return out;
+}
+
+struct Result {
+    int64_t index;
+    std::string fen;
+    int64_t score;
+    Move best_move;
+    std::string pv;
+    int nodes;
+};
+
+static std::string format_result(const Result& r, OutputFormat format) {
+    std::string best = r.best_move == NULL_MOVE ? "" : to_uci_move(r.best_move);
+
+    if (format == FORMAT_JSONL) {
+        return std::format("{{\"index\":{},\"fen\":\"{}\",\"score\":{},\"bestmove\":\"{}\",\"nodes\":{},\"pv\":\"{}\"}}\n",
+            r.index, json_escape(r.fen), r.score, best, r.nodes, r.pv);
+    }
+
+    return std::format("{},{},{},{},{},{}\n", r.index, r.fen, r.score, best, r.nodes, r.pv);
+}
+
+static Result analyse(Position& pos, SearchContext& s, const Options& opts, int64_t index, const std::string& fen) {
+    Result r = {
+        .index = index,
+        .fen = fen,
+        .score = 0,
+        .best_move = NULL_MOVE,
+        .pv = "",
+        .nodes = 0,
+    };
+
+    if (opts.mode == MODE_EVAL) {
+        r.score = pos.signed_eval();
+        return r;
+    }
+
+    NodeBudgeter node_budgeter(opts.limit);
+    s.budgeter = opts.mode == MODE_NODES ? static_cast<Budgeter*>(&node_budgeter) : &null_budgeter;
+
+    int depth = opts.mode == MODE_DEPTH ? opts.limit : MAX_DEPTH - 1;
+
+    s.should_stop = false; // a node limit from the previous position leaves this set
+
+    // each position is searched from scratch unless asked otherwise, so a result doesn't
+    // depend on which positions the same thread searched before it
+    if (!opts.keep_tables) {
+        s.clear();
+    }
+
+    r.best_move = pos.best_move(s, depth, false, &r.score);
+    r.nodes = pos.node_count;
+
+    if (r.best_move != NULL_MOVE) {
+        for (Move m : pos.extract_pv(s, r.best_move)) {
+            if (!r.pv.empty()) {
+                r.pv += " ";
+            }
+
+            r.pv += to_uci_move(m);
+        }
+    }
+
+    s.budgeter = &null_budgeter;
+
+    return r;
+}
+
+static std::optional<Options> parse_options(int argc, const char** argv) {
+    if (argc < 3) {
+        return std::nullopt;
+    }
+
+    Options opts;
+    opts.input = argv[1];
+    opts.output = argv[2];
+
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--depth" && has_value) {
+            opts.mode = MODE_DEPTH;
+            opts.limit = atoi(argv[++i]);
+        }
+        else if (arg == "--nodes" && has_value) {
+            opts.mode = MODE_NODES;
+            opts.limit = atoi(argv[++i]);
+        }
+        else if (arg == "--eval") {
+            opts.mode = MODE_EVAL;
+        }
+        else if (arg == "--threads" && has_value) {
+            opts.threads = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--hash" && has_value) {
+            opts.hash_kb = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--keep-tables") {
+            opts.keep_tables = true;
+        }
+        else if (arg == "--jsonl") {
+            opts.format = FORMAT_JSONL;
+        }
+        else if (arg == "--csv") {
+            opts.format = FORMAT_CSV;
+        }
+        else {
+            return std::nullopt;
+        }
+    }
+
+    return opts;
+}
+
+int main(int argc, const char** argv) {
+    auto parsed = parse_options(argc, argv);
+
+    if (!parsed) {
+        print("Usage: {} <input.epd> <output> [--depth N | --nodes N | --eval] [--threads N] [--hash KB] [--keep-tables] [--csv | --jsonl]\n", argv[0]);
+        return 1;
+    }
+
+    Options opts = *parsed;
+
+    FILE* in = fopen(opts.input.c_str(), "rb");
+
+    if (!in) {
+        print("Failed to open '{}'\n", opts.input);
+        return 1;
+    }
+
+    FILE* out = fopen(opts.output.c_str(), "wb");
+
+    if (!out) {
+        print("Failed to open '{}'\n", opts.output);
+        fclose(in);
+        return 1;
+    }
+
+    if (opts.format == FORMAT_CSV) {
+        fputs("index,fen,score,bestmove,nodes,pv\n", out);
+    }
+
+    BoundedQueue<Job> queue(size_t(opts.threads) * 4);
+
+    std::mutex out_mutex;
+    std::atomic<int64_t> done = 0;
+    std::atomic<int64_t> invalid = 0;
+
+    TimePoint start = Clock::now();
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < opts.threads; ++t) {
+        threads.push_back(std::thread([&]() {
+            std::atomic<bool> should_stop = false;
+            auto context = std::make_unique<SearchContext>(SearchParameters{}, should_stop, &null_budgeter);
+
+            int hash_kb = opts.hash_kb > 0 ? opts.hash_kb : opts.keep_tables ? 0 : CLEARED_HASH_KB;
+
+            if (hash_kb > 0) {
+                context->tt.resize(std::bit_floor(std::max(size_t(hash_kb) * 1024 / sizeof(TTCluster), size_t(1))));
+            }
+
+            Job job;
+
+            while (queue.pop(&job)) {
+                std::optional<std::string> fen = extract_fen(job.line);
+                std::optional<Position> pos = fen ? Position::parse_fen(*fen) : std::nullopt;
+
+                if (!pos) {
+                    invalid++;
+                    continue;
+                }
+
+                Result r = analyse(*pos, *context, opts, job.index, *fen);
+                std::string text = format_result(r, opts.format);
+
+                {
+                    std::lock_guard lock(out_mutex);
+                    fwrite(text.data(), 1, text.size(), out);
+                }
+
+                int64_t n = ++done;
+
+                if (n % 10000 == 0) {
+                    double elapsed = double(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count()) / 1000.0;
+                    std::lock_guard lock(out_mutex);
+                    print("{} positions ({:.0f}/s)\n", n, double(n) / std::max(elapsed, 0.001));
+                }
+            }
+        }));
+    }
+
+    std::string line;
+    int64_t index = 0;
+    char buf[4096];
+
+    // lines longer than the buffer arrive in pieces, stitch them back together
+    while (fgets(buf, sizeof(buf), in)) {
+        line += buf;
+
+        if (line.back() != '\n' && !feof(in)) {
+            continue;
+        }
+
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+
+        if (!line.empty() && line[0] != '#') {
+            queue.push({ .index = index++, .line = std::move(line) });
+        }
+
+        line.clear();
+    }
+
+    queue.close();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    fclose(in);
+    fclose(out);
+
+    print("Analysed {} positions, skipped {} invalid lines\n", done.load(), invalid.load());
+
+    return 0;
+}
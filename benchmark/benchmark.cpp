@@ -74,6 +74,7 @@ static void benchmark_pos_method(const std::string& name, int start_depth, int m
         print("  pv_nodes: {}\n", pos.pv_node_count);
         print("  beta_cutoffs: {}\n", pos.beta_cutoffs);
         print("  null-prunes: {}\n", pos.null_prunes);
+        print("  probcut-prunes: {}\n", pos.probcut_prunes);
         print("  NPS: {:.2}\n", nps);
         print("  reduced-searches: {}\n", pos.reduced_searches);
         print("  reduced-fail-high: {} ({:.2}%)\n", pos.reduced_fail_high, reduced_fail_high_rate*100.0);
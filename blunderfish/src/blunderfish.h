@@ -1,6 +1,8 @@
 #pragma once
 
 #include <optional>
+#include <algorithm>
+#include <climits>
 #include <unordered_map>
 #include <array>
 #include <chrono>
@@ -9,6 +11,9 @@
 #include <fstream>
 #include <iostream>
 #include <cstdio>
+#include <mutex>
+#include <functional>
+#include <memory>
 
 #include "common.h"
 
@@ -17,6 +22,7 @@
 constexpr size_t _ACCUMULATOR_PERSP_SIZE = 64;
 
 float nnue_infer(std::span<uint64_t> bbs);
+void nnue_infer_batch(std::span<const std::array<uint64_t, 12>> positions, std::span<float> out); // out[i] = nnue_infer(positions[i])
 
 using Clock = std::chrono::steady_clock;
 using TimePoint = std::chrono::time_point<Clock>;
@@ -30,6 +36,8 @@ using TimePoint = std::chrono::time_point<Clock>;
 
 constexpr int64_t INF        = 400000000;
 constexpr int64_t MATE_SCORE = 32000; // just shy of int16 bounds
+constexpr int64_t TB_WIN_SCORE = MATE_SCORE - 1000 - MAX_DEPTH; // below any mate score
+constexpr int64_t DECISIVE_SCORE = TB_WIN_SCORE - MAX_DEPTH;      // tablebase wins and mates lie beyond this, evals below
 
 static constexpr size_t TRANSPOSITION_TABLE_SIZE = 1 << 16;
 
@@ -131,19 +139,35 @@ struct Undo {
     int en_passant_sq;
     int64_t incremental_eval;
     uint64_t zobrist;
+    uint64_t polyglot;
     bool is_checked[2];
     int half_move_clock;
 };
 
+constexpr int64_t EVAL_PENDING = INT64_MIN;
+
+// What a node needs to know about checks for the side to move, computed once so moves can be tested without making them
+struct CheckInfo {
+    uint64_t checkers;                       // enemy pieces giving check
+    uint64_t pinned;                         // our pieces that may only move along the line to our king
+    uint64_t discoverers;                    // our pieces that uncover a check on the enemy king by leaving their line
+    uint64_t check_squares[NUM_PIECE_TYPES]; // squares each of our piece types would give check from
+};
+
 struct TTEntry {
     uint32_t key32;
     int16_t score;
     uint8_t depth;
     uint8_t flag;
     Move best_move;
-    uint32_t padding;
+    uint8_t generation; // search the entry was last written or hit in, stale entries are replaced first
+    uint8_t padding;
+    int16_t static_eval; // raw eval for the side to move, TT_EVAL_NONE if unknown
 };
 
+constexpr int16_t TT_EVAL_NONE = INT16_MIN;
+constexpr int TT_DEPTH_QSEARCH = 0; // entries written by quiescence, below any depth negamax probes for a cutoff
+
 struct TTCluster {
     TTEntry entries[4];
 };
@@ -161,6 +185,8 @@ struct SearchParameters {
     float history_malus_factor = 0.622954f;
     float cont_history_bonus_factor = 0.987245f;
     float cont_history_malus_factor = 0.944155f;
+    float capture_history_bonus_factor = 1.0f;
+    float capture_history_malus_factor = 1.0f;
     int qsearch_big_delta = 1206;
     int qsearch_delta_margin = 350;
     int asp_initial_window_size = 13;
@@ -169,6 +195,7 @@ struct SearchParameters {
     float nmp_r_divisor = 6.86391f;
     float lmp_index_base = 2.96918f;
     float lmp_index_factor = 2.28471f;
+    int probcut_margin = 200;
 };
 #else
 struct SearchParameters {
@@ -183,6 +210,8 @@ struct SearchParameters {
     float history_malus_factor = 0.95008f;
     float cont_history_bonus_factor = 0.46919f;
     float cont_history_malus_factor = 0.48449f;
+    float capture_history_bonus_factor = 1.0f;
+    float capture_history_malus_factor = 1.0f;
     int qsearch_big_delta = 1223;
     int qsearch_delta_margin = 70;
     int asp_initial_window_size = 12;
@@ -191,26 +220,77 @@ struct SearchParameters {
     float nmp_r_divisor = 7.25516f;
     float lmp_index_base = 3.44978f;
     float lmp_index_factor = 2.32816f;
+    int probcut_margin = 200;
 };
 #endif
 
-using KillerTable = std::array<std::array<Move, 2>, MAX_DEPTH>;
+// Describes one tunable SearchParameters field and the range it is tuned over. Shared by spsa,
+// the UCI options and anything else that sets parameters by name.
+struct SearchParameterInfo {
+    const char* name;
+    float lo;
+    float hi;
+    bool is_int; // rounded when set
+    float (*get)(const SearchParameters& p);
+    void (*set)(SearchParameters& p, float value);
+};
+
+std::span<const SearchParameterInfo> search_parameter_table();
+const SearchParameterInfo* find_search_parameter(std::string_view name);
+
 using HistoryTable = std::array<std::array<int32_t, 64>, NUM_PIECE_TYPES>;
-using EvalHistory = std::array<int64_t, MAX_DEPTH>;
 
 using ContinuationTable = std::array<std::array<int32_t, 64>, NUM_PIECE_TYPES>;
 using ContinuationHistory = std::array<std::array<ContinuationTable, 64>, NUM_PIECE_TYPES>;
 
+using CounterMoveTable = std::array<std::array<Move, 64>, NUM_PIECE_TYPES>; // by the piece and square of the previous move
+using CaptureHistoryTable = std::array<std::array<std::array<int32_t, NUM_PIECE_TYPES>, 64>, NUM_PIECE_TYPES>; // [piece][to][captured]
+
+// Learned static eval error, by side to move and a hash of part of the position
+constexpr size_t CORRECTION_HISTORY_SIZE = 16384;
+using CorrectionHistory = std::array<std::array<int32_t, CORRECTION_HISTORY_SIZE>, 2>;
+
+// What the search knows about one ply of the current line
+struct SearchStackFrame {
+    Move move = NULL_MOVE;              // being searched from this ply, NULL_MOVE for a null move
+    Piece piece = PIECE_NONE;           // moving piece and its destination
+    int to = 0;
+    ContinuationTable* reply_cont = nullptr;      // history of the opponent's replies to move, nullptr after a null move
+    ContinuationTable* follow_up_cont[2] = {};    // history of our own moves 2 and 4 plies later
+    int64_t static_eval = 0;
+    std::array<Move, 2> killers = {};
+    Move excluded_move = NULL_MOVE;     // skipped by a singular extension search
+};
+
+// Frames before the root are left empty so history lookups can always go this many plies back
+constexpr int SEARCH_STACK_OFFSET = 4;
+using SearchStack = std::array<SearchStackFrame, MAX_DEPTH + SEARCH_STACK_OFFSET>;
+
 class TranspositionTable {
 public:
     std::vector<TTCluster> table;
+    uint64_t mask = TRANSPOSITION_TABLE_SIZE - 1;
+
+    uint8_t generation = 0;
 
     TranspositionTable()
         : table(TRANSPOSITION_TABLE_SIZE) {}
 
+    // clusters must be a power of two, a small table is quicker to clear between many short searches
+    void resize(size_t clusters) {
+        table.assign(clusters, TTCluster{});
+        mask = clusters - 1;
+        generation = 0;
+    }
+
     TTCluster& operator[](uint64_t index) {
         return table[index];
     }
+
+    void clear() {
+        std::fill(table.begin(), table.end(), TTCluster{});
+        generation = 0;
+    }
 };
 
 struct ZobristTable {
@@ -226,6 +306,16 @@ struct ZobristTable {
 
 extern const ZobristTable zobrist_table;
 
+// The Polyglot book randoms rearranged to be indexed like zobrist_table. PIECE_NONE entries are zero
+struct PolyglotTable {
+    uint64_t white_to_move;
+    std::array<uint64_t, 64> piece[2][NUM_PIECE_TYPES];
+    uint64_t flags[16];
+    uint64_t ep_file[8];
+};
+
+extern const PolyglotTable polyglot_table;
+
 struct EvalParameters {
     // Material
     int piece_values[NUM_PIECE_TYPES];
@@ -256,20 +346,53 @@ struct EvalParameters {
 
 struct SearchContext {
     TranspositionTable tt;
-    KillerTable killers;
+    SearchStack stack;
     HistoryTable history;
-    EvalHistory eval_history;
     ContinuationHistory cont_history;
+    ContinuationHistory follow_up_history[2]; // 2 and 4 plies on, kept apart from replies as pieces don't carry a colour
+    CounterMoveTable counter_moves;
+    CaptureHistoryTable capture_history;
+    CorrectionHistory pawn_correction;
+    CorrectionHistory non_pawn_correction[2]; // keyed by white's and black's pieces
 
     SearchParameters params;
 
     std::atomic<bool>& should_stop;
     class Budgeter* budgeter;
 
+    int tb_cardinality = 0; // probe tablebases in search with at most this many pieces
+    int multi_pv = 1;       // number of best root moves to report a line for
+
+    std::array<int, 64 * 64> root_move_nodes; // nodes searched below each root move in the current iteration, indexed by from * 64 + to
+
     SearchContext(const SearchParameters& params, std::atomic<bool>& should_stop, class Budgeter* budgeter)
-        : tt({}), killers({}), history({}), eval_history({}), cont_history({}), params(params), should_stop(should_stop), budgeter(budgeter)
+        : tt({}), stack({}), history({}), cont_history({}), follow_up_history{}, counter_moves({}), capture_history({}), pawn_correction({}), non_pawn_correction{}, params(params), should_stop(should_stop), budgeter(budgeter), root_move_nodes({})
     {
     }
+
+    // called at the start of every search, the TT and history tables carry over between searches
+    void new_search() {
+        tt.generation++;
+        stack = {};
+        root_move_nodes = {};
+    }
+
+    SearchStackFrame* frame(int ply) {
+        return &stack[ply + SEARCH_STACK_OFFSET];
+    }
+
+    // forget everything, e.g. for a new game
+    void clear() {
+        tt.clear();
+        stack = {};
+        history = {};
+        memset(cont_history.data(), 0, sizeof(cont_history)); // too big for a temporary on the stack
+        memset(follow_up_history, 0, sizeof(follow_up_history));
+        counter_moves = {};
+        capture_history = {};
+        memset(pawn_correction.data(), 0, sizeof(pawn_correction));
+        memset(non_pawn_correction, 0, sizeof(non_pawn_correction));
+    }
 };
 
 // Pack as exactly 16 bytes
@@ -311,7 +434,8 @@ enum GameResultReason {
     GAME_RESULT_CHECKMATE,
     GAME_RESULT_STALEMATE,
     GAME_RESULT_3_FOLD_REPETITION,
-    GAME_RESULT_50_MOVE_RULE
+    GAME_RESULT_50_MOVE_RULE,
+    GAME_RESULT_ADJUDICATED
 };
 
 struct GameResult {
@@ -319,11 +443,22 @@ struct GameResult {
     GameResultReason reason;
 };
 
+// What the search learned from the last completed iteration
+struct IterationInfo {
+    int depth;
+    Move best_move;
+    int64_t score;
+    double best_move_effort; // fraction of the iteration's nodes spent below the best root move
+};
+
 class Budgeter {
 public:
     virtual ~Budgeter() = default;
     virtual void init() {}
     virtual bool should_exit(struct Position& pos) const = 0;
+
+    // called after every completed iteration, return false to stop deepening
+    virtual bool should_start_iteration(const IterationInfo& last) { (void)last; return true; }
 };
 
 class NullBudgeter : public Budgeter {
@@ -352,6 +487,7 @@ struct Position {
     bool is_checked[2];
 
     uint64_t zobrist;
+    uint64_t polyglot; // Polyglot key without its en passant term, which encode_polyglot() adds
 
     // benchmarking statistics
     int max_ply;
@@ -360,17 +496,19 @@ struct Position {
     int pv_node_count;
     int beta_cutoffs;
     int null_prunes; 
+    int probcut_prunes;
     int cutoff_index_count;
     int cutoff_index_sum;
     int reduced_searches;
     int reduced_fail_high;
+    int tb_hits;
 
     std::vector<Undo> undo_stack;
 
 #ifdef USE_NNUE
     std::vector<Accumulator> accumulator_stack;
 #endif
-    int64_t incr_eval;
+    int64_t incr_eval; // white's eval, EVAL_PENDING in NNUE builds until white_eval() runs the network
 
     Position()
         : to_move(WHITE), en_passant_sq(NULL_SQUARE), flags(0), half_move_clock(0)
@@ -378,6 +516,7 @@ struct Position {
         memset(sides, 0, sizeof(sides));
         memset(piece_at, 0, sizeof(piece_at));
         zobrist = compute_zobrist();
+        polyglot = compute_polyglot();
         reset_benchmarking_statistics();
         #ifdef USE_NNUE
         accumulator_stack.push_back({});
@@ -391,9 +530,11 @@ struct Position {
     std::array<uint64_t, 12> to_bitboards() const;
 
     MoveList generate_moves() const;
+    MoveList generate_moves(uint64_t pin_mask) const;
     MoveList generate_captures() const;
 
     std::unordered_map<std::string, Move> name_moves(std::span<Move> moves);
+    std::optional<Move> parse_san(std::string_view san); // legal moves only, check and annotation marks are ignored
 
     uint64_t all_pieces() const;
 
@@ -408,10 +549,15 @@ struct Position {
     int get_king_sq(int side) const;
     uint64_t generate_pin_mask(int side) const;
 
+    CheckInfo check_info() const;
+    bool gives_check(Move move, const CheckInfo& ci) const; // without making the move
+
     bool is_king_square_attacked(int side, int square) const;
 
     int lowest_value_defender(int defender_side, int sq, uint64_t occupancy) const;
     int see(Move m) const;
+    uint64_t attackers_to(int square, uint64_t occupancy) const; // both sides' pieces, sliders as seen through the occupancy
+    bool see_ge(Move m, int threshold) const; // see(m) >= threshold, stopping as soon as the answer is known
 
     void filter_moves(MoveList& moves);
 
@@ -420,26 +566,32 @@ struct Position {
     int64_t compute_eval() const;
     int64_t nnue_eval() const;
 
+    int64_t white_eval();
     int64_t signed_eval();
 
     // @note if no castle, make rook_from == rook_ro
     void update_eval(Piece captured_piece, int captured_pos, Piece moving_piece_start, Piece moving_piece_end, int move_from, int move_to, int rook_from, int rook_to, int side, int sign=1);
     void update_is_checked();
 
-    int64_t negamax(SearchContext& s, int depth, int ply, bool allow_null, int64_t alpha, int64_t beta, Move excluded_move, int extensions_so_far, int root_depth, ContinuationTable* cont);
+    int64_t negamax(SearchContext& s, int depth, int ply, bool allow_null, int64_t alpha, int64_t beta, int extensions_so_far, int root_depth);
     int64_t quiescence(SearchContext& s, int ply, int64_t alpha, int64_t beta);
 
     int32_t mvv_lva_score(Move mv, int32_t offset) const;
 
     std::pair<Move, int64_t> best_move_internal(SearchContext& s, MoveList& moves, int depth, Move last_best_move, int64_t alpha, int64_t beta);
     Move best_move(int depth, std::atomic<bool>& should_stop, Budgeter* budgeter = &null_budgeter, const SearchParameters& params = {}, bool enable_uci_info=false, int64_t* score_out=nullptr);
+    Move best_move(SearchContext& s, int depth, bool enable_uci_info=false, int64_t* score_out=nullptr, Move* ponder_out=nullptr);
+    std::vector<Move> extract_pv(SearchContext& s, Move first_move, int max_length=50);
     
     bool is_move_legal_slow(Move move);
+    bool is_move_pseudo_legal(Move move) const;
+    bool is_move_legal(Move move);
 
     std::optional<GameResult> game_result();
     Move think(int depth, std::atomic<bool>& should_stop, Budgeter* budgeter = &null_budgeter, const SearchParameters& params_in = {}, bool enable_uci_info = false);
 
     uint64_t compute_zobrist() const;
+    uint64_t compute_polyglot() const;
 
     void update_en_passant_sq(int sq);
 
@@ -465,7 +617,7 @@ struct Position {
     #endif
 
     // polygot encoding & decoding
-    uint64_t encode_polyglot();
+    uint64_t encode_polyglot() const;
     Move decode_polyglot(PolyglotEntry move);
 };
 
@@ -545,15 +697,71 @@ inline uint64_t bb_to_file(uint64_t bb) {
 }
 
 uint64_t knight_moves(int from, uint64_t allies);
+uint64_t king_moves(int from, uint64_t allies);
 uint64_t rook_moves(int from, uint64_t all_pieces, uint64_t allies);
 uint64_t bishop_moves(int from, uint64_t all_pieces, uint64_t allies);
 uint64_t queen_moves(int from, uint64_t all_pieces, uint64_t allies);
 
 // Polygot
-PolyglotEntry read_entry(uint64_t index);
-uint64_t find_first(uint64_t key, uint64_t num_entries);
-std::vector<PolyglotEntry> probe_book(uint64_t key);
-PolyglotEntry choose_move(const std::vector<PolyglotEntry>& moves);
+constexpr size_t MAX_BOOK_MOVES = 64; // entries returned for one position
+constexpr int BOOK_MISS_LIMIT = 4;    // consecutive misses after which a BookSet stops probing
+
+// A Polyglot book mapped from disk, or the one embedded at build time. The big endian keys are
+// swapped once into a sorted index at load, and only the matching entries are decoded per probe.
+class OpeningBook {
+public:
+    bool open(const std::string& path);
+    void open_embedded();
+
+    // fills out with the entries for key, in native byte order, and returns how many there were
+    size_t probe(uint64_t key, std::span<PolyglotEntry> out) const;
+
+    size_t size() const { return _keys.size(); }
+
+private:
+    MappedFile _file;
+    const PolyglotEntry* _entries = nullptr;
+    std::vector<uint64_t> _keys;
+
+    void index(const PolyglotEntry* entries, size_t count);
+};
+
+const OpeningBook& embedded_book();
+PolyglotEntry choose_move(std::span<const PolyglotEntry> moves);
+
+uint16_t encode_polyglot_move(Move move); // castling is written as the king taking its own rook
+bool write_polyglot_book(const std::string& path, std::vector<PolyglotEntry> entries); // entries in native byte order, any order
+
+// Books in priority order, the first one that knows the position picks the move
+class BookSet {
+public:
+    bool load(const std::string& paths); // separated like SyzygyPath, "<empty>" for none
+    void new_game() { _misses = 0; }
+
+    std::optional<Move> probe(Position& pos);
+
+private:
+    std::vector<std::unique_ptr<OpeningBook>> _books;
+    int _misses = 0;
+};
+
+// Syzygy tablebases
+std::vector<std::string> split_paths(const std::string& paths); // on ':', or ';' on windows
+enum WDLScore {
+    WDL_LOSS         = -2,
+    WDL_BLESSED_LOSS = -1, // loss saved by the 50-move rule
+    WDL_DRAW         = 0,
+    WDL_CURSED_WIN   = 1,  // win spoiled by the 50-move rule
+    WDL_WIN          = 2
+};
+
+int tb_init(const std::string& paths); // returns the number of tables found
+void tb_set_probe_limit(int pieces);
+int tb_cardinality();
+
+WDLScore tb_probe_wdl(Position& pos, bool* success);
+int tb_probe_dtz(Position& pos, bool* success);
+bool tb_filter_root_moves(Position& pos, MoveList& moves, bool* dtz_ranked);
 
 
 template<typename T>
@@ -585,6 +793,42 @@ private:
     TimePoint _start;
 };
 
+struct ClockState {
+    int time_ms;
+    int increment_ms;
+    int moves_to_go; // 0 when the rest of the game must be played in time_ms
+};
+
+// Splits the budget into a soft limit, past which no new iteration is started, and a hard
+// limit that aborts the search. On a clock the soft limit is scaled by how settled the search looks.
+class TimeManager : public Budgeter {
+public:
+    TimeManager(double seconds, int node_limit = INT_MAX); // fixed time per move
+    TimeManager(const ClockState& clock, int node_limit = INT_MAX);
+
+    virtual void init() override;
+    virtual bool should_exit(Position& pos) const override;
+    virtual bool should_start_iteration(const IterationInfo& last) override;
+
+    double elapsed() const;
+    void restart() { _start = Clock::now(); }
+
+    double soft_limit() const { return _soft; }
+    double hard_limit() const { return _hard; }
+
+private:
+    double _soft;
+    double _hard;
+    int _node_limit;
+    bool _adaptive;
+
+    std::atomic<TimePoint> _start;
+
+    Move _last_best_move;
+    int _stability;
+    int64_t _last_score;
+};
+
 class NodeBudgeter : public Budgeter {
 public:
     NodeBudgeter(int count)
@@ -597,4 +841,103 @@ public:
 
 private:
     int _limit;
-};
\ No newline at end of file
+};
+
+// Training data written by datagen: a PackedFileHeader followed by PackedRecords.
+// Pieces are stored one nibble per occupied square, in square order, holding the
+// index into to_bitboards(). Scores are white relative.
+constexpr uint32_t PACKED_MAGIC = 0x4b504642; // "BFPK"
+constexpr uint32_t PACKED_VERSION = 1;
+
+struct PackedFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct PackedRecord {
+    uint64_t occupancy;
+    uint8_t pieces[16];
+    int16_t score;
+    int8_t max_ply;
+    int8_t outcome;
+    uint8_t reserved[4];
+};
+
+static_assert(sizeof(PackedFileHeader) == 16);
+static_assert(sizeof(PackedRecord) == 32);
+
+PackedRecord pack_record(const std::array<uint64_t, 12>& bbs, int16_t score, int8_t max_ply, int8_t outcome);
+std::array<uint64_t, 12> unpack_bitboards(const PackedRecord& r);
+
+bool read_packed_header(FILE* file); // false if the file is not a packed record file of this version
+
+// Appends records to one file from several threads. Writes are made in blocks by RecordBuffer,
+// so the lock is only taken once per flush. A failed write is remembered and reported by close().
+class RecordWriter {
+public:
+    RecordWriter() = default;
+    ~RecordWriter() { close(); }
+
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
+
+    bool open(const std::string& path);
+    bool close(); // false if any write since open failed
+
+    void write(std::span<const PackedRecord> records);
+
+private:
+    FILE* _file = nullptr;
+    bool _failed = false;
+    std::mutex _mutex;
+};
+
+class RecordBuffer {
+public:
+    RecordBuffer(RecordWriter& writer, size_t capacity = 1 << 16)
+        : _writer(writer), _capacity(capacity)
+    {
+        _records.reserve(capacity);
+    }
+
+    ~RecordBuffer() { flush(); }
+
+    void push(const PackedRecord& r) {
+        _records.push_back(r);
+
+        if (_records.size() >= _capacity) {
+            flush();
+        }
+    }
+
+    void flush() {
+        _writer.write(_records);
+        _records.clear();
+    }
+
+private:
+    RecordWriter& _writer;
+    size_t _capacity;
+    std::vector<PackedRecord> _records;
+};
+
+// Cuts self-play games short once the outcome is clear. Scores are the engine's own, from the side to move.
+struct AdjudicationConfig {
+    int64_t resign_score = 1000; // a win once |score| stays above this, with the same winner, for resign_plies plies
+    int resign_plies = 6;
+    int64_t draw_score = 10;     // a draw once |score| stays below this for draw_plies plies
+    int draw_plies = 12;
+    int draw_min_ply = 60;       // no draw adjudication before this ply of the game
+    bool use_tablebases = true;  // a result by WDL once the position is in the tablebases
+};
+
+// Called with every searched position before its move is played, score is white relative
+using SelfPlayCallback = std::function<void(Position& pos, Move move, int64_t score)>;
+
+// Plays pos out with contexts[WHITE] and contexts[BLACK] searching to at most depth under their budgeters.
+// Both may point to the same context. Contexts are cleared at the start and keep their tables across moves.
+GameResult play_selfplay_game(Position& pos, SearchContext* const contexts[2], int depth, const AdjudicationConfig& adjudication = {}, const SelfPlayCallback& on_move = nullptr);
+
+const char* describe_game_result(const GameResult& result);
@@ -95,4 +95,25 @@ private:
 #else
     #define RESTRICT
     #define ALWAYS_INLINE inline
-#endif
\ No newline at end of file
+#endif
+// Read-only memory mapping of an entire file
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool is_open() const { return _data != nullptr; }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+    void* _handle = nullptr; // mapping handle on windows
+};
@@ -470,7 +470,7 @@ int64_t Position::mobility(int colour) const {
 
 int64_t Position::signed_eval() {
     int64_t sign = to_move == WHITE ? 1 : -1;
-    return incr_eval * sign;
+    return white_eval() * sign;
 }
  
 inline int32_t piece_delta(Piece piece, int sq, int side) {
@@ -482,6 +482,10 @@ inline int32_t piece_delta(Piece piece, int sq, int side) {
 }
 
 #ifndef USE_NNUE
+int64_t Position::white_eval() {
+    return incr_eval;
+}
+
 void Position::update_eval(Piece captured_piece, int captured_pos, Piece moving_piece_start, Piece moving_piece_end, int move_from, int move_to, int rook_from, int rook_to, int side, int sign) {
     (void)captured_piece;
     (void)captured_pos;
@@ -0,0 +1,95 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file); // the mapping keeps the file alive
+
+    if (!mapping) {
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!view) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    _data = static_cast<const uint8_t*>(view);
+    _size = size_t(size.QuadPart);
+    _handle = mapping;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+
+    if (view == MAP_FAILED) {
+        return false;
+    }
+
+#ifdef MADV_RANDOM
+    madvise(view, size_t(st.st_size), MADV_RANDOM);
+#endif
+
+    _data = static_cast<const uint8_t*>(view);
+    _size = size_t(st.st_size);
+#endif
+
+    return true;
+}
+
+void MappedFile::close() {
+    if (!_data) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(_handle);
+#else
+    munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+
+    _data = nullptr;
+    _size = 0;
+    _handle = nullptr;
+}
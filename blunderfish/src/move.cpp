@@ -252,6 +252,102 @@ int Position::see(Move m) const {
     return value[0];
 }
 
+uint64_t Position::attackers_to(int square, uint64_t occupancy) const {
+    const Side& white = sides[WHITE];
+    const Side& black = sides[BLACK];
+
+    uint64_t diag_sliders     = white.bb[PIECE_BISHOP] | white.bb[PIECE_QUEEN] | black.bb[PIECE_BISHOP] | black.bb[PIECE_QUEEN];
+    uint64_t straight_sliders = white.bb[PIECE_ROOK]   | white.bb[PIECE_QUEEN] | black.bb[PIECE_ROOK]   | black.bb[PIECE_QUEEN];
+
+    return (black_pawn_attacks_table[square] & white.bb[PIECE_PAWN])
+         | (white_pawn_attacks_table[square] & black.bb[PIECE_PAWN])
+         | (knight_moves(square, 0) & (white.bb[PIECE_KNIGHT] | black.bb[PIECE_KNIGHT]))
+         | (king_moves(square, 0) & (white.bb[PIECE_KING] | black.bb[PIECE_KING]))
+         | (bishop_moves(square, occupancy, 0) & diag_sliders)
+         | (rook_moves(square, occupancy, 0) & straight_sliders);
+}
+
+// Same exchange as see(), but the attackers are found once and only the sliders behind a piece that
+// leaves are added. swap is how far the side to move is from the threshold, and the exchange ends as
+// soon as the side to capture can't change the answer.
+bool Position::see_ge(Move m, int threshold) const {
+    static const Piece attacker_order[] = { PIECE_PAWN, PIECE_KNIGHT, PIECE_BISHOP, PIECE_ROOK, PIECE_QUEEN, PIECE_KING };
+
+    int from = move_from(m);
+    int sq = move_to(m);
+
+    int swap = piece_value_table[move_captured_piece(m)] - threshold;
+
+    if (swap < 0) {
+        return false; // not enough even if the piece is undefended
+    }
+
+    swap = piece_value_table[piece_at[from]] - swap;
+
+    if (swap <= 0) {
+        return true; // enough even if the capturing piece is lost
+    }
+
+    uint64_t occupancy = all_pieces() & ~(sq_to_bb(from) | sq_to_bb(sq) | sq_to_bb(move_captured_square(m)));
+    uint64_t attackers = attackers_to(sq, occupancy);
+
+    uint64_t diag_sliders = 0;
+    uint64_t straight_sliders = 0;
+
+    for (const Side& side : sides) {
+        diag_sliders     |= side.bb[PIECE_BISHOP] | side.bb[PIECE_QUEEN];
+        straight_sliders |= side.bb[PIECE_ROOK]   | side.bb[PIECE_QUEEN];
+    }
+
+    int side = to_move;
+    int result = 1;
+
+    for (;;) {
+        side = opponent(side);
+        attackers &= occupancy;
+
+        uint64_t side_attackers = attackers & sides[side].all();
+
+        if (side_attackers == 0) {
+            break;
+        }
+
+        result ^= 1;
+
+        Piece attacker = PIECE_NONE;
+
+        for (Piece p : attacker_order) {
+            if (side_attackers & sides[side].bb[p]) {
+                attacker = p;
+                break;
+            }
+        }
+
+        if (attacker == PIECE_KING) {
+            // the king can't capture into a square that is still attacked
+            return (attackers & ~sides[side].all()) ? result == 0 : result == 1;
+        }
+
+        swap = piece_value_table[attacker] - swap;
+
+        if (swap < result) {
+            break;
+        }
+
+        occupancy ^= sq_to_bb(std::countr_zero(side_attackers & sides[side].bb[attacker]));
+
+        if (attacker == PIECE_PAWN || attacker == PIECE_BISHOP || attacker == PIECE_QUEEN) {
+            attackers |= bishop_moves(sq, occupancy, 0) & diag_sliders;
+        }
+
+        if (attacker == PIECE_ROOK || attacker == PIECE_QUEEN) {
+            attackers |= rook_moves(sq, occupancy, 0) & straight_sliders;
+        }
+    }
+
+    return result == 1;
+}
+
 inline bool pinned(int sq, uint64_t pin_mask) {
     return (sq_to_bb(sq) & pin_mask) != 0;
 }
@@ -270,6 +366,10 @@ static bool illegal_pin_move(int from, int to, int king_sq, uint64_t pin_mask) {
 } while (false)
 
 MoveList Position::generate_moves() const {
+    return generate_moves(generate_pin_mask(to_move));
+}
+
+MoveList Position::generate_moves(uint64_t pin_mask) const {
     MoveList moves;
     moves.count = 0;
 
@@ -279,7 +379,6 @@ MoveList Position::generate_moves() const {
     uint64_t all = all_pieces();
 
     int king_sq = get_king_sq(to_move);
-    uint64_t pin_mask = generate_pin_mask(to_move);
 
     for (uint8_t from : set_bits(sides[to_move].bb[PIECE_KING])) {
         for (uint8_t to : set_bits(king_moves(from, allies))) {
@@ -693,6 +792,7 @@ void Position::update_en_passant_sq(int sq) {
 void Position::make_move(Move move) {
     // Update eval
     uint64_t initial_zobrist = zobrist;
+    uint64_t initial_polyglot = polyglot;
     int64_t initial_eval = incr_eval;
     int initial_half_move_clock = half_move_clock;
 
@@ -705,6 +805,7 @@ void Position::make_move(Move move) {
     int captured_pos = move_captured_square(move);
     zobrist ^= bool_to_mask<uint64_t>(captured_piece != PIECE_NONE) & zobrist_table.piece[opponent(to_move)][captured_piece][captured_pos];
 #endif
+    polyglot ^= polyglot_table.piece[opponent(to_move)][captured_piece][captured_pos]; // zero when nothing is captured
 
     // Before we modify anything, record the destroyable data in the undo stack
     Undo undo = {
@@ -713,6 +814,7 @@ void Position::make_move(Move move) {
         .en_passant_sq = en_passant_sq,
         .incremental_eval = initial_eval,
         .zobrist = initial_zobrist,
+        .polyglot = initial_polyglot,
         .is_checked = {
             is_checked[0],
             is_checked[1]
@@ -736,6 +838,8 @@ void Position::make_move(Move move) {
     zobrist ^= zobrist_table.piece[to_move][start_piece][move_from(move)];
     zobrist ^= zobrist_table.piece[to_move][end_piece][move_to(move)];
 #endif
+    polyglot ^= polyglot_table.piece[to_move][start_piece][move_from(move)];
+    polyglot ^= polyglot_table.piece[to_move][end_piece][move_to(move)];
 
     uint64_t from_mask = sq_to_bb(move_from(move));
     uint64_t to_mask = sq_to_bb(move_to(move));
@@ -766,6 +870,7 @@ void Position::make_move(Move move) {
 #ifdef ZOBRIST_INCLUDE_FLAGS
     zobrist ^= zobrist_table.flags[diff];
 #endif
+    polyglot ^= polyglot_table.flags[diff];
 
     // set the en passant square if a double push has occured
     int en_passant_table[] = {
@@ -792,6 +897,8 @@ void Position::make_move(Move move) {
     zobrist ^= zobrist_table.piece[to_move][PIECE_ROOK][rook_from];
     zobrist ^= zobrist_table.piece[to_move][PIECE_ROOK][rook_to]; // if not castle, same square so net zero change
 #endif
+    polyglot ^= polyglot_table.piece[to_move][PIECE_ROOK][rook_from];
+    polyglot ^= polyglot_table.piece[to_move][PIECE_ROOK][rook_to];
 
 #ifdef USE_NNUE
     accumulator_stack.emplace_back(accumulator_stack.back()); // push an accumulator onto the stack
@@ -805,6 +912,7 @@ void Position::make_move(Move move) {
 #ifdef ZOBRIST_INCLUDE_SIDE
     zobrist ^= zobrist_table.side;
 #endif
+    polyglot ^= polyglot_table.white_to_move;
 
     update_is_checked();
 
@@ -884,6 +992,7 @@ void Position::unmake_move() {
     flags = undo.flags;
     en_passant_sq = undo.en_passant_sq;
     zobrist = undo.zobrist;
+    polyglot = undo.polyglot;
     half_move_clock = undo.half_move_clock;
 }
 
@@ -894,6 +1003,7 @@ void Position::make_null_move() {
         .en_passant_sq = en_passant_sq,
         .incremental_eval = incr_eval,
         .zobrist = zobrist,
+        .polyglot = polyglot,
         .is_checked = {
             is_checked[0],
             is_checked[1]
@@ -906,6 +1016,7 @@ void Position::make_null_move() {
 #ifdef ZOBRIST_INCLUDE_SIDE
     zobrist ^= zobrist_table.side;
 #endif
+    polyglot ^= polyglot_table.white_to_move;
 
     update_is_checked();
 
@@ -928,36 +1039,134 @@ void Position::unmake_null_move(){
     flags = undo.flags;
     en_passant_sq = undo.en_passant_sq;
     zobrist = undo.zobrist;
+    polyglot = undo.polyglot;
     half_move_clock = undo.half_move_clock;
 }
 
+// the pieces out of `candidates` that are the only piece between a slider and the king square
+static uint64_t lone_blockers(const Position& pos, int king_sq, uint64_t diag_sliders, uint64_t straight_sliders, uint64_t candidates) {
+    uint64_t others = pos.all_pieces() & ~candidates;
+
+    uint64_t diags     = bishop_moves(king_sq, others, 0); // seeing through the candidates
+    uint64_t straights =   rook_moves(king_sq, others, 0); // seeing through the candidates
+
+    uint64_t attackers = (diags & diag_sliders) | (straights & straight_sliders);
+
+    uint64_t result = 0;
+
+    for (int atk_sq : set_bits(attackers)) {
+        uint64_t blockers = between[atk_sq][king_sq] & candidates;
+
+        if (std::popcount(blockers) == 1) {
+            result |= blockers;
+        }
+    }
+
+    return result;
+}
+
 uint64_t Position::generate_pin_mask(int side) const {
-    int king_sq = get_king_sq(side);
+    const Side& opp = sides[opponent(side)];
+    uint64_t queens = opp.bb[PIECE_QUEEN];
 
-    uint64_t opps = sides[opponent(side)].all();
-    uint64_t allies = sides[side].all();
+    return lone_blockers(*this, get_king_sq(side), opp.bb[PIECE_BISHOP] | queens, opp.bb[PIECE_ROOK] | queens, sides[side].all());
+}
 
-    uint64_t diags     = bishop_moves(king_sq, opps, 0); // excluding all our own pieces
-    uint64_t straights =   rook_moves(king_sq, opps, 0); // excluding all our own pieces
+CheckInfo Position::check_info() const {
+    int us = to_move;
+    int them = opponent(us);
 
-    uint64_t rooks   = sides[opponent(side)].bb[PIECE_ROOK];
-    uint64_t bishops = sides[opponent(side)].bb[PIECE_BISHOP];
-    uint64_t queens  = sides[opponent(side)].bb[PIECE_QUEEN];
+    const Side& own = sides[us];
+    const Side& opp = sides[them];
 
-    uint64_t attackers = (diags & (bishops|queens)) | (straights & (rooks|queens));
+    uint64_t all = all_pieces();
+    int king_sq = get_king_sq(us);
+    int opp_king_sq = get_king_sq(them);
 
-    uint64_t pinned = 0;
+    CheckInfo ci;
 
-    for (int atk_sq : set_bits(attackers)) {
-        uint64_t mask = between[atk_sq][king_sq];
-        uint64_t blockers = mask & allies;
+    uint64_t pawn_mask = us == WHITE ? white_pawn_attacks_table[king_sq] : black_pawn_attacks_table[king_sq];
 
-        if (std::popcount(blockers) == 1) { // that guy is pinned
-            pinned |= sq_to_bb(std::countr_zero(blockers));
-        }
+    ci.checkers = (pawn_mask & opp.bb[PIECE_PAWN])
+                | (knight_moves(king_sq, 0) & opp.bb[PIECE_KNIGHT])
+                | (bishop_moves(king_sq, all, 0) & (opp.bb[PIECE_BISHOP] | opp.bb[PIECE_QUEEN]))
+                | (rook_moves(king_sq, all, 0) & (opp.bb[PIECE_ROOK] | opp.bb[PIECE_QUEEN]));
+
+    ci.pinned = generate_pin_mask(us);
+    ci.discoverers = lone_blockers(*this, opp_king_sq, own.bb[PIECE_BISHOP] | own.bb[PIECE_QUEEN], own.bb[PIECE_ROOK] | own.bb[PIECE_QUEEN], own.all());
+
+    uint64_t diags     = bishop_moves(opp_king_sq, all, 0);
+    uint64_t straights =   rook_moves(opp_king_sq, all, 0);
+
+    ci.check_squares[PIECE_NONE]   = 0;
+    ci.check_squares[PIECE_PAWN]   = us == WHITE ? black_pawn_attacks_table[opp_king_sq] : white_pawn_attacks_table[opp_king_sq];
+    ci.check_squares[PIECE_ROOK]   = straights;
+    ci.check_squares[PIECE_KNIGHT] = knight_moves(opp_king_sq, 0);
+    ci.check_squares[PIECE_BISHOP] = diags;
+    ci.check_squares[PIECE_QUEEN]  = diags | straights;
+    ci.check_squares[PIECE_KING]   = 0;
+
+    return ci;
+}
+
+bool Position::gives_check(Move move, const CheckInfo& ci) const {
+    int from = move_from(move);
+    int to = move_to(move);
+
+    const Side& own = sides[to_move];
+    int king_sq = get_king_sq(opponent(to_move));
+    uint64_t king_bb = sq_to_bb(king_sq);
+
+    Piece end_piece = move_end_piece(move);
+
+    if (ci.check_squares[end_piece] & sq_to_bb(to)) {
+        return true;
+    }
+
+    if ((ci.discoverers & sq_to_bb(from)) && (line[from][king_sq] & sq_to_bb(to)) == 0) {
+        return true;
     }
 
-    return pinned;
+    switch (move_type(move)) {
+        case MOVE_PROMOTION: {
+            // the check squares were found with the pawn still in the way
+            uint64_t occupancy = all_pieces() ^ sq_to_bb(from);
+            uint64_t attacks = 0;
+
+            if (end_piece == PIECE_ROOK || end_piece == PIECE_QUEEN) {
+                attacks |= rook_moves(to, occupancy, 0);
+            }
+
+            if (end_piece == PIECE_BISHOP || end_piece == PIECE_QUEEN) {
+                attacks |= bishop_moves(to, occupancy, 0);
+            }
+
+            return (attacks & king_bb) != 0;
+        }
+
+        case MOVE_EN_PASSANT: {
+            // the captured pawn leaves its square too, which may open a line to the king
+            uint64_t occupancy = (all_pieces() ^ sq_to_bb(from) ^ sq_to_bb(move_captured_square(move))) | sq_to_bb(to);
+
+            uint64_t diag_sliders     = own.bb[PIECE_BISHOP] | own.bb[PIECE_QUEEN];
+            uint64_t straight_sliders = own.bb[PIECE_ROOK] | own.bb[PIECE_QUEEN];
+
+            return (bishop_moves(king_sq, occupancy, 0) & diag_sliders) || (rook_moves(king_sq, occupancy, 0) & straight_sliders);
+        }
+
+        case MOVE_SHORT_CASTLE:
+        case MOVE_LONG_CASTLE: {
+            int rook_from = rook_jump_from[to];
+            int rook_to = rook_jump_to[to];
+
+            uint64_t occupancy = (all_pieces() ^ sq_to_bb(from) ^ sq_to_bb(rook_from)) | sq_to_bb(to) | sq_to_bb(rook_to);
+
+            return (rook_moves(rook_to, occupancy, 0) & king_bb) != 0;
+        }
+
+        default:
+            return false;
+    }
 }
 
 std::string to_uci_move(Move move) {
@@ -994,6 +1203,106 @@ std::string to_uci_move(Move move) {
     return result;
 }
 
+std::optional<Move> Position::parse_san(std::string_view san) {
+    while (!san.empty() && (san.back() == '+' || san.back() == '#' || san.back() == '!' || san.back() == '?')) {
+        san.remove_suffix(1);
+    }
+
+    MoveList moves = generate_moves();
+    filter_moves(moves);
+
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        MoveType type = san.size() == 3 ? MOVE_SHORT_CASTLE : MOVE_LONG_CASTLE;
+
+        for (Move mv : moves) {
+            if (move_type(mv) == type) {
+                return mv;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    auto letter_piece = [](char c) {
+        switch (c) {
+            case 'N': return PIECE_KNIGHT;
+            case 'B': return PIECE_BISHOP;
+            case 'R': return PIECE_ROOK;
+            case 'Q': return PIECE_QUEEN;
+            case 'K': return PIECE_KING;
+            default:  return PIECE_NONE;
+        }
+    };
+
+    Piece piece = PIECE_PAWN;
+
+    if (!san.empty() && letter_piece(san.front()) != PIECE_NONE) {
+        piece = letter_piece(san.front());
+        san.remove_prefix(1);
+    }
+
+    // promotions are usually e8=Q, but e8Q turns up too
+    Piece promotion = PIECE_NONE;
+
+    if (piece == PIECE_PAWN && !san.empty() && letter_piece(san.back()) != PIECE_NONE) {
+        promotion = letter_piece(san.back());
+        san.remove_suffix(1);
+
+        if (!san.empty() && san.back() == '=') {
+            san.remove_suffix(1);
+        }
+    }
+
+    if (san.size() < 2) {
+        return std::nullopt;
+    }
+
+    int to_file = san[san.size() - 2] - 'a';
+    int to_rank = san[san.size() - 1] - '1';
+
+    if (to_file < 0 || to_file > 7 || to_rank < 0 || to_rank > 7) {
+        return std::nullopt;
+    }
+
+    int from_file = -1;
+    int from_rank = -1;
+
+    for (char c : san.substr(0, san.size() - 2)) {
+        if (c >= 'a' && c <= 'h') {
+            from_file = c - 'a';
+        }
+        else if (c >= '1' && c <= '8') {
+            from_rank = c - '1';
+        }
+        else if (c != 'x') {
+            return std::nullopt;
+        }
+    }
+
+    std::optional<Move> found;
+
+    for (Move mv : moves) {
+        int from = move_from(mv);
+        MoveType type = move_type(mv);
+
+        if (piece_at[from] != piece || move_to(mv) != to_rank * 8 + to_file
+            || type == MOVE_SHORT_CASTLE || type == MOVE_LONG_CASTLE
+            || (from_file >= 0 && (from & 7) != from_file)
+            || (from_rank >= 0 && (from >> 3) != from_rank)
+            || (type == MOVE_PROMOTION ? move_end_piece(mv) != promotion : promotion != PIECE_NONE)) {
+            continue;
+        }
+
+        if (found) {
+            return std::nullopt; // ambiguous
+        }
+
+        found = mv;
+    }
+
+    return found;
+}
+
 bool Position::is_move_legal_slow(Move move) {
     MoveList moves = generate_moves();
     filter_moves(moves);
@@ -1007,6 +1316,141 @@ bool Position::is_move_legal_slow(Move move) {
     return false;
 }
 
+// Cheap test that a move could have been generated in this position, without considering pins or checks.
+// Castling is the exception, it is fully checked here as its rules are all about attacked squares.
+bool Position::is_move_pseudo_legal(Move move) const {
+    if (move == NULL_MOVE || move_side(move) != to_move) {
+        return false;
+    }
+
+    int from = move_from(move);
+    int to = move_to(move);
+    MoveType type = move_type(move);
+
+    int opp = opponent(to_move);
+    uint64_t allies = sides[to_move].all();
+    uint64_t all = all_pieces();
+
+    if ((allies & sq_to_bb(from)) == 0 || (allies & sq_to_bb(to)) != 0) {
+        return false;
+    }
+
+    Piece piece = Piece(piece_at[from]);
+    Piece end_piece = move_end_piece(move);
+
+    // the captured piece has to be an enemy piece that is actually there
+    Piece captured = move_captured_piece(move);
+    int captured_sq = get_captured_square(to, type, to_move);
+
+    if (Piece(piece_at[captured_sq]) != captured || captured == PIECE_KING) {
+        return false;
+    }
+
+    if (captured != PIECE_NONE && (sides[opp].all() & sq_to_bb(captured_sq)) == 0) {
+        return false;
+    }
+
+    int forward = to_move == WHITE ? 8 : -8;
+    uint64_t promotion_rank = to_move == WHITE ? RANK_8 : RANK_1;
+    uint64_t pawn_attacks = to_move == WHITE ? white_pawn_attacks_table[from] : black_pawn_attacks_table[from];
+
+    switch (type) {
+        case MOVE_NORMAL: {
+            if (end_piece != piece) {
+                return false;
+            }
+
+            switch (piece) {
+                case PIECE_PAWN:
+                    if (sq_to_bb(to) & promotion_rank) {
+                        return false;
+                    }
+
+                    return captured == PIECE_NONE ? to == from + forward : (pawn_attacks & sq_to_bb(to)) != 0;
+
+                case PIECE_KNIGHT: return (knight_moves(from, allies) & sq_to_bb(to)) != 0;
+                case PIECE_BISHOP: return (bishop_moves(from, all, allies) & sq_to_bb(to)) != 0;
+                case PIECE_ROOK:   return (rook_moves(from, all, allies) & sq_to_bb(to)) != 0;
+                case PIECE_QUEEN:  return (queen_moves(from, all, allies) & sq_to_bb(to)) != 0;
+                case PIECE_KING:   return (king_moves(from, allies) & sq_to_bb(to)) != 0;
+                default:           return false;
+            }
+        }
+
+        case MOVE_DOUBLE_PUSH: {
+            uint64_t start_rank = to_move == WHITE ? RANK_2 : RANK_7;
+
+            return piece == PIECE_PAWN
+                && end_piece == PIECE_PAWN
+                && (sq_to_bb(from) & start_rank) != 0
+                && to == from + 2 * forward
+                && (all & (sq_to_bb(from + forward) | sq_to_bb(to))) == 0;
+        }
+
+        case MOVE_EN_PASSANT:
+            return piece == PIECE_PAWN
+                && end_piece == PIECE_PAWN
+                && to == en_passant_sq
+                && captured == PIECE_PAWN
+                && (pawn_attacks & sq_to_bb(to)) != 0;
+
+        case MOVE_PROMOTION: {
+            if (piece != PIECE_PAWN || (sq_to_bb(to) & promotion_rank) == 0) {
+                return false;
+            }
+
+            if (end_piece != PIECE_QUEEN && end_piece != PIECE_ROOK && end_piece != PIECE_BISHOP && end_piece != PIECE_KNIGHT) {
+                return false;
+            }
+
+            return captured == PIECE_NONE ? to == from + forward : (pawn_attacks & sq_to_bb(to)) != 0;
+        }
+
+        case MOVE_SHORT_CASTLE:
+        case MOVE_LONG_CASTLE: {
+            bool is_short = type == MOVE_SHORT_CASTLE;
+
+            uint32_t flag = to_move == WHITE ? (is_short ? POSITION_FLAG_WHITE_KCASTLE : POSITION_FLAG_WHITE_QCASTLE)
+                                             : (is_short ? POSITION_FLAG_BLACK_KCASTLE : POSITION_FLAG_BLACK_QCASTLE);
+
+            uint64_t space = to_move == WHITE ? (is_short ? WHITE_SHORT_SPACING : WHITE_LONG_SPACING)
+                                              : (is_short ? BLACK_SHORT_SPACING : BLACK_LONG_SPACING);
+
+            int king_from = to_move == WHITE ? 4 : 60;
+            int king_to = king_from + (is_short ? 2 : -2);
+            int passed = king_from + (is_short ? 1 : -1);
+
+            return piece == PIECE_KING
+                && end_piece == PIECE_KING
+                && from == king_from
+                && to == king_to
+                && captured == PIECE_NONE
+                && (flags & flag) != 0
+                && (space & all) == 0
+                && !is_checked[to_move]
+                && !is_king_square_attacked(to_move, passed)
+                && !is_king_square_attacked(to_move, king_to);
+        }
+    }
+
+    return false;
+}
+
+// Much cheaper than is_move_legal_slow, a single make/unmake instead of generating every move
+bool Position::is_move_legal(Move move) {
+    if (!is_move_pseudo_legal(move)) {
+        return false;
+    }
+
+    int side = to_move;
+
+    make_move(move);
+    bool legal = !is_checked[side];
+    unmake_move();
+
+    return legal;
+}
+
 bool Position::is_quiescent() {
     if (is_checked[to_move]) {
         return false;
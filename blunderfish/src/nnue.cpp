@@ -151,6 +151,124 @@ float nnue_infer(std::span<uint64_t> bbs) {
     return forward_accumulator(accumulator[0]);
 }
 
+// Positions per tile in the batched dense layer, each output neuron's weights are loaded once per tile
+static constexpr size_t BATCH_TILE = 8;
+
+// Same as feed_l1, but keeps the whole accumulator half in registers while the weight rows are added
+static void feed_l1_simd(int16_t* RESTRICT a0, int* RESTRICT indices, int index_count) {
+#if defined(__AVX2__)
+    static_assert(NNUE_ACCUMULATOR_PERSP_SIZE == 64);
+
+    __m256i acc[4];
+
+    for (size_t k = 0; k < 4; ++k) {
+        acc[k] = _mm256_load_si256((const __m256i*)&nnue_b0[k * 16]);
+    }
+
+    for (int ji = 0; ji < index_count; ++ji) {
+        const int8_t* row = nnue_w0[indices[ji]];
+
+        for (size_t k = 0; k < 4; ++k) {
+            __m128i w = _mm_load_si128((const __m128i*)&row[k * 16]);
+            acc[k] = _mm256_add_epi16(acc[k], _mm256_cvtepi8_epi16(w)); // int8 -> int16
+        }
+    }
+
+    for (size_t k = 0; k < 4; ++k) {
+        _mm256_store_si256((__m256i*)&a0[k * 16], acc[k]);
+    }
+#else
+    feed_l1(a0, indices, index_count);
+#endif
+}
+
+// Hidden layer for a tile of positions, returns the activations of each
+static void forward_l1_tile(const uint8_t (*a0)[NNUE_ACCUMULATOR_PERSP_SIZE*2], uint8_t (*a1)[std::size(nnue_b1)], size_t count) {
+    for (size_t i = 0; i < std::size(nnue_b1); ++i) {
+#if defined(__AVX2__)
+        static_assert(NNUE_ACCUMULATOR_PERSP_SIZE * 2 == 128);
+
+        __m256i w[4];
+
+        for (size_t k = 0; k < 4; ++k) {
+            w[k] = _mm256_load_si256((const __m256i*)&nnue_w1[i][k * 32]);
+        }
+
+        __m256i ones = _mm256_set1_epi16(1);
+
+        for (size_t b = 0; b < count; ++b) {
+            __m256i sum = _mm256_setzero_si256();
+
+            // same pairing as forward_accumulator, so maddubs saturates identically
+            for (size_t k = 0; k < 4; ++k) {
+                __m256i act  = _mm256_load_si256((const __m256i*)&a0[b][k * 32]);
+                __m256i prod = _mm256_maddubs_epi16(act, w[k]);
+                sum = _mm256_add_epi32(sum, _mm256_madd_epi16(prod, ones));
+            }
+
+            __m128i lo = _mm256_castsi256_si128(sum);
+            __m128i hi = _mm256_extracti128_si256(sum, 1);
+            __m128i s  = _mm_add_epi32(lo, hi);
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+            s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+            int32_t value = _mm_cvtsi128_si32(s) + nnue_b1[i];
+
+            a1[b][i] = scaled_crelu<int32_t, uint8_t, 255>(value, 64*255);
+        }
+#else
+        for (size_t b = 0; b < count; ++b) {
+            int32_t value = nnue_b1[i];
+
+            for (size_t j = 0; j < NNUE_ACCUMULATOR_PERSP_SIZE*2; ++j) {
+                value += int16_t(nnue_w1[i][j]) * int16_t(a0[b][j]);
+            }
+
+            a1[b][i] = scaled_crelu<int32_t, uint8_t, 255>(value, 64*255);
+        }
+#endif
+    }
+}
+
+void nnue_infer_batch(std::span<const std::array<uint64_t, 12>> positions, std::span<float> out) {
+    assert(out.size() >= positions.size());
+
+    alignas(32) int16_t accumulator[2][NNUE_ACCUMULATOR_PERSP_SIZE];
+    alignas(32) uint8_t a0[BATCH_TILE][NNUE_ACCUMULATOR_PERSP_SIZE*2];
+    alignas(32) uint8_t a1[BATCH_TILE][std::size(nnue_b1)];
+
+    for (size_t start = 0; start < positions.size(); start += BATCH_TILE) {
+        size_t count = std::min(BATCH_TILE, positions.size() - start);
+
+        for (size_t b = 0; b < count; ++b) {
+            std::array<uint64_t, 12> bbs = positions[start + b];
+
+            auto white_persp = get_persp_indices(bbs, WHITE);
+            auto black_persp = get_persp_indices(bbs, BLACK);
+
+            feed_l1_simd(accumulator[0], white_persp.data, white_persp.count);
+            feed_l1_simd(accumulator[1], black_persp.data, black_persp.count);
+
+            const int16_t* flat = accumulator[0];
+
+            for (size_t j = 0; j < NNUE_ACCUMULATOR_PERSP_SIZE*2; ++j) {
+                a0[b][j] = scaled_crelu<int16_t, uint8_t, 255>(flat[j], int16_t(64));
+            }
+        }
+
+        forward_l1_tile(a0, a1, count);
+
+        for (size_t b = 0; b < count; ++b) {
+            int32_t value = nnue_b2[0];
+
+            for (size_t j = 0; j < std::size(nnue_b1); ++j) {
+                value += int16_t(nnue_w2[0][j]) * int16_t(a1[b][j]);
+            }
+
+            out[start + b] = scaled_sigmoid(value, 64*255);
+        }
+    }
+}
+
 inline int64_t wdl_to_centipawns(float wdl) {
     wdl = std::clamp(wdl, 1e-7f, 1.0f - 1e-7f);
     int64_t centipawns = int64_t(400.0f * logf(wdl/(1.0f-wdl)));
@@ -237,6 +355,14 @@ static void update_accumulator_persp(int16_t* RESTRICT accumulator_half, Piece c
 void Position::update_eval(Piece captured_piece, int captured_pos, Piece moving_piece_start, Piece moving_piece_end, int move_from, int move_to, int rook_from, int rook_to, int side, int sign) {
     update_accumulator_persp(acc().half(WHITE), captured_piece, captured_pos, moving_piece_start, moving_piece_end, move_from, move_to, rook_from, rook_to, side, sign, WHITE);
     update_accumulator_persp(acc().half(BLACK), captured_piece, captured_pos, moving_piece_start, moving_piece_end, move_from, move_to, rook_from, rook_to, side, sign, BLACK);
-    incr_eval = wdl_to_centipawns(forward_accumulator(acc().ptr()));
+    incr_eval = EVAL_PENDING; // the forward pass waits until the eval is asked for, which a TT hit may spare
+}
+
+int64_t Position::white_eval() {
+    if (incr_eval == EVAL_PENDING) {
+        incr_eval = wdl_to_centipawns(forward_accumulator(acc().ptr()));
+    }
+
+    return incr_eval;
 }
 #endif
\ No newline at end of file
@@ -49,79 +49,84 @@ uint64_t to_big_endian(uint64_t x) {
         return x;
 }
 
-// Position Methods
+constexpr PolyglotTable initialize_polyglot_table() {
+    PolyglotTable table = {};
 
-/** 
- Encodes the polyglot hash key to use polyglot openning books
-*/
-uint64_t Position::encode_polyglot() {
-    uint64_t piece_hash = 0;
-    uint64_t castle_hash = 0;
-    uint64_t enpassant_hash = 0;
-    uint64_t turn_hash = 0;
-
-    int piece_values[] = { -1, 0, 6, 2, 4, 8, 10 };
-
-    // 1. Piece Hashing
-    for (int sq = 0; sq < 64; ++sq) {
-        int piece = piece_at[sq];
-        
-        if (piece == PIECE_NONE) {
-            continue;
-        }
+    // Polyglot orders pieces as black pawn, white pawn, black knight, white knight and so on
+    int kinds[NUM_PIECE_TYPES] = { -1, 0, 6, 2, 4, 8, 10 };
 
-        int piece_val = piece_values[piece];
-        
-        // If white +1 the value of the piece for different index
-        if (sq_to_bb(sq) & sides[WHITE].all()) {
-            piece_val += 1;
+    for (int side = 0; side < 2; ++side) {
+        for (int piece = PIECE_PAWN; piece < NUM_PIECE_TYPES; ++piece) {
+            int kind = kinds[piece] + (side == WHITE);
+
+            for (int sq = 0; sq < 64; ++sq) {
+                table.piece[side][piece][sq] = POLYGLOT_RANDOM[64 * kind + sq];
+            }
         }
+    }
 
-        int row = sq / 8;
-        int file = sq % 8;
-        int index = (64 * piece_val) + (8 * row) + file;
-        
-        piece_hash ^= POLYGLOT_RANDOM[index];
+    for (int i = 0; i < 16; ++i) {
+        if (i & POSITION_FLAG_WHITE_KCASTLE) table.flags[i] ^= POLYGLOT_RANDOM[768];
+        if (i & POSITION_FLAG_WHITE_QCASTLE) table.flags[i] ^= POLYGLOT_RANDOM[769];
+        if (i & POSITION_FLAG_BLACK_KCASTLE) table.flags[i] ^= POLYGLOT_RANDOM[770];
+        if (i & POSITION_FLAG_BLACK_QCASTLE) table.flags[i] ^= POLYGLOT_RANDOM[771];
     }
 
-    // 2. Castling Hashing
-    int castle_offset = 768;
-    if (flags & POSITION_FLAG_WHITE_KCASTLE) castle_hash ^= POLYGLOT_RANDOM[castle_offset + 0];
-    if (flags & POSITION_FLAG_WHITE_QCASTLE) castle_hash ^= POLYGLOT_RANDOM[castle_offset + 1];
-    if (flags & POSITION_FLAG_BLACK_KCASTLE) castle_hash ^= POLYGLOT_RANDOM[castle_offset + 2];
-    if (flags & POSITION_FLAG_BLACK_QCASTLE) castle_hash ^= POLYGLOT_RANDOM[castle_offset + 3];
-
-    // 3. En Passant Hashing
-    if (en_passant_sq) {
-        
-        // Polyglot only applies enpassant hash if the pawn is capturable
-        bool can_capture = false;
-        int ep_file = en_passant_sq % 8;
-        
-        // Check left
-        if (ep_file > 0) {
-            int left = en_passant_sq + (to_move == WHITE ? -9 : 7);
-            if (piece_at[left] == PIECE_PAWN && (sq_to_bb(left) & sides[to_move].all())) 
-                can_capture = true;
-        }
+    for (int file = 0; file < 8; ++file) {
+        table.ep_file[file] = POLYGLOT_RANDOM[772 + file];
+    }
 
-        // Check right
-        if (ep_file < 7) {
-            int right = en_passant_sq + (to_move == WHITE ? -7 : 9);
-            if (piece_at[right] == PIECE_PAWN && (sq_to_bb(right) & sides[to_move].all())) 
-                can_capture = true;
-        }
+    table.white_to_move = POLYGLOT_RANDOM[780];
 
-        if (can_capture) {
-            enpassant_hash ^= POLYGLOT_RANDOM[772 + ep_file];
+    return table;
+}
+
+const PolyglotTable polyglot_table = initialize_polyglot_table();
+
+// Position Methods
+
+/**
+ Computes the Polyglot key from scratch, minus the en passant term. make_move keeps Position::polyglot equal to this
+*/
+uint64_t Position::compute_polyglot() const {
+    uint64_t hash = 0;
+
+    for (int side = 0; side < 2; ++side) {
+        for (int piece = PIECE_PAWN; piece < NUM_PIECE_TYPES; ++piece) {
+            for (int sq : set_bits(sides[side].bb[piece])) {
+                hash ^= polyglot_table.piece[side][piece][sq];
+            }
         }
     }
 
+    hash ^= polyglot_table.flags[flags];
+
     if (to_move == WHITE) {
-        turn_hash ^= POLYGLOT_RANDOM[780];
+        hash ^= polyglot_table.white_to_move;
+    }
+
+    return hash;
+}
+
+/** 
+ Encodes the polyglot hash key to use polyglot openning books
+*/
+uint64_t Position::encode_polyglot() const {
+    if (en_passant_sq == NULL_SQUARE) {
+        return polyglot;
     }
 
-    return (piece_hash ^ castle_hash ^ enpassant_hash ^ turn_hash);
+    // Polyglot only applies the en passant hash if a pawn can actually capture
+    int ep_file = en_passant_sq % 8;
+    int behind = en_passant_sq + (to_move == WHITE ? -8 : 8);
+
+    uint64_t adjacent = ((ep_file > 0) ? sq_to_bb(behind - 1) : 0) | ((ep_file < 7) ? sq_to_bb(behind + 1) : 0);
+
+    if (adjacent & sides[to_move].bb[PIECE_PAWN]) {
+        return polyglot ^ polyglot_table.ep_file[ep_file];
+    }
+
+    return polyglot;
 }
 
 
@@ -140,18 +145,19 @@ Move Position::decode_polyglot(PolyglotEntry move) {
         case 4: end_piece = PIECE_QUEEN;  type = MOVE_PROMOTION; break;
     }
 
-    // Catch castle moves
+    // Castling is written as the king taking its own rook, older books use the king's destination instead
     uint64_t to_bb = sq_to_bb(to);
     uint64_t from_bb = sq_to_bb(from);
-
-    if ((from_bb & (FILE_E & RANK_1)) && (to_bb & (FILE_G & RANK_1))) {
-        type = MOVE_SHORT_CASTLE;
-    } else if ((from_bb & (FILE_E & RANK_1)) && (to_bb & (FILE_C & RANK_1))) {
-        type = MOVE_LONG_CASTLE;
-    } else if ((from_bb & (FILE_E & RANK_8)) && (to_bb & (FILE_G & RANK_8))) {
-        type = MOVE_SHORT_CASTLE;
-    } else if ((from_bb & (FILE_E & RANK_8)) && (to_bb & (FILE_C & RANK_8))) {
-        type = MOVE_LONG_CASTLE;
+    uint64_t back_rank = to_move == WHITE ? RANK_1 : RANK_8;
+
+    if (end_piece == PIECE_KING && (from_bb & FILE_E & back_rank)) {
+        if (to_bb & (FILE_G | FILE_H) & back_rank) {
+            type = MOVE_SHORT_CASTLE;
+            to = from + 2;
+        } else if (to_bb & (FILE_A | FILE_C) & back_rank) {
+            type = MOVE_LONG_CASTLE;
+            to = from - 2;
+        }
     }
 
     // Catch en passant moves
@@ -176,61 +182,111 @@ Move Position::decode_polyglot(PolyglotEntry move) {
 
 
 
-PolyglotEntry read_entry(uint64_t index) {
-    const PolyglotEntry* entries = reinterpret_cast<const PolyglotEntry*>(OPENING_BOOK);
-    PolyglotEntry e = entries[index];
+uint16_t encode_polyglot_move(Move move) {
+    int from = move_from(move);
+    int to = move_to(move);
 
-    // convert big endian to little endian
-    // TODO: Check if windows or linux system.
-    e.key = byteswap_u64(e.key);
-    e.move = byteswap_u16(e.move);
-    e.weight = byteswap_u16(e.weight);
-    e.learn = byteswap_u32(e.learn);
+    if (move_type(move) == MOVE_SHORT_CASTLE) {
+        to = from + 3;
+    } else if (move_type(move) == MOVE_LONG_CASTLE) {
+        to = from - 4;
+    }
 
-    return e;
+    int prom = 0;
+
+    if (move_type(move) == MOVE_PROMOTION) {
+        switch (move_end_piece(move)) {
+            case PIECE_KNIGHT: prom = 1; break;
+            case PIECE_BISHOP: prom = 2; break;
+            case PIECE_ROOK:   prom = 3; break;
+            case PIECE_QUEEN:  prom = 4; break;
+            default: break;
+        }
+    }
+
+    return uint16_t((prom << 12) | (from << 6) | to);
 }
 
-uint64_t find_first(uint64_t key, uint64_t num_entries) {
+static PolyglotEntry to_native(PolyglotEntry e) {
+    if constexpr (std::endian::native == std::endian::little) {
+        e.key = byteswap_u64(e.key);
+        e.move = byteswap_u16(e.move);
+        e.weight = byteswap_u16(e.weight);
+        e.learn = byteswap_u32(e.learn);
+    }
 
-    uint64_t low = 0;
-    uint64_t high = num_entries;
+    return e;
+}
 
-    while (low < high) {
-        uint64_t mid = low + (high - low) / 2;
-        PolyglotEntry e = read_entry(mid);
+bool OpeningBook::open(const std::string& path) {
+    _keys.clear();
+    _entries = nullptr;
 
-        if (e.key < key) {
-            low = mid + 1;
-        } else {
-            high = mid;
-        }
+    if (!_file.open(path)) {
+        return false;
     }
 
-    return low;
+    index(reinterpret_cast<const PolyglotEntry*>(_file.data()), _file.size() / sizeof(PolyglotEntry));
+    return true;
 }
 
-std::vector<PolyglotEntry> probe_book(uint64_t key) {
+void OpeningBook::open_embedded() {
+    _file.close();
+    index(reinterpret_cast<const PolyglotEntry*>(OPENING_BOOK), OPENING_BOOK_SIZE / sizeof(PolyglotEntry));
+}
 
-    uint64_t num_entries =OPENING_BOOK_SIZE / sizeof(PolyglotEntry);
-    uint64_t idx = find_first(key, num_entries);
-    std::vector<PolyglotEntry> moves;
+// Polyglot files are sorted by key, so swapping the keys once gives a sorted native index to search
+void OpeningBook::index(const PolyglotEntry* entries, size_t count) {
+    _entries = entries;
+    _keys.resize(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        _keys[i] = to_native(entries[i]).key;
+    }
+}
 
-    while (idx < num_entries) {
+// Sorted by key as probing expects, and by descending weight within a position like other book writers
+bool write_polyglot_book(const std::string& path, std::vector<PolyglotEntry> entries) {
+    std::sort(entries.begin(), entries.end(), [](const PolyglotEntry& a, const PolyglotEntry& b) {
+        return a.key != b.key ? a.key < b.key : a.weight > b.weight;
+    });
 
-        PolyglotEntry e = read_entry(idx);
+    for (PolyglotEntry& e : entries) {
+        e = to_native(e); // swapping is its own inverse
+    }
 
-        if (e.key != key) {
-            break;
-        }
+    FILE* file = fopen(path.c_str(), "wb");
 
-        moves.push_back(e);
-        ++idx;
+    if (!file) {
+        return false;
     }
 
-    return moves;
+    size_t written = fwrite(entries.data(), sizeof(PolyglotEntry), entries.size(), file);
+    fclose(file);
+
+    return written == entries.size();
 }
 
-PolyglotEntry choose_move(const std::vector<PolyglotEntry>& moves) {
+const OpeningBook& embedded_book() {
+    static OpeningBook book;
+    static bool loaded = (book.open_embedded(), true);
+    (void)loaded;
+
+    return book;
+}
+
+size_t OpeningBook::probe(uint64_t key, std::span<PolyglotEntry> out) const {
+    auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+    size_t n = 0;
+
+    for (size_t i = size_t(it - _keys.begin()); i < _keys.size() && _keys[i] == key && n < out.size(); ++i) {
+        out[n++] = to_native(_entries[i]);
+    }
+
+    return n;
+}
+
+PolyglotEntry choose_move(std::span<const PolyglotEntry> moves) {
 
     // Safety check
     if (moves.empty()) {
@@ -244,8 +300,7 @@ PolyglotEntry choose_move(const std::vector<PolyglotEntry>& moves) {
     }
 
     // Create rng
-    static std::random_device rd;  
-    static std::mt19937 gen(rd());
+    static thread_local std::mt19937 gen(std::random_device{}());
 
     // If all moves have 0 weight, pick one uniformly at random
     if (total == 0) {
@@ -266,3 +321,51 @@ PolyglotEntry choose_move(const std::vector<PolyglotEntry>& moves) {
 
     return moves[0];
 }
+
+bool BookSet::load(const std::string& paths) {
+    _books.clear();
+    _misses = 0;
+
+    if (paths == "<empty>") {
+        return true;
+    }
+
+    for (const std::string& path : split_paths(paths)) {
+        auto book = std::make_unique<OpeningBook>();
+
+        if (!book->open(path)) {
+            _books.clear();
+            return false;
+        }
+
+        _books.push_back(std::move(book));
+    }
+
+    return true;
+}
+
+std::optional<Move> BookSet::probe(Position& pos) {
+    if (_books.empty() || _misses >= BOOK_MISS_LIMIT) {
+        return std::nullopt;
+    }
+
+    uint64_t key = pos.encode_polyglot();
+
+    for (const auto& book : _books) {
+        std::array<PolyglotEntry, MAX_BOOK_MOVES> entries;
+        size_t n = book->probe(key, entries);
+
+        // a key collision could hand back moves from another position
+        PolyglotEntry* end = std::remove_if(entries.begin(), entries.begin() + n, [&](const PolyglotEntry& e) {
+            return !pos.is_move_legal(pos.decode_polyglot(e));
+        });
+
+        if (end != entries.begin()) {
+            _misses = 0;
+            return pos.decode_polyglot(choose_move(std::span(entries.begin(), end)));
+        }
+    }
+
+    _misses++;
+    return std::nullopt;
+}
@@ -3,7 +3,7 @@
 #include <cstdint>
 
 // Stolen from https://sources.debian.org/src/scid/1%3A4.7.4%2Bdfsg1-2.1/src/polyglot/random.cpp/?utm_source=chatgpt.com
-const uint64_t POLYGLOT_RANDOM[781] = {
+constexpr uint64_t POLYGLOT_RANDOM[781] = {
   uint64_t(0x9D39247E33776D41), uint64_t(0x2AF7398005AAA5C7), uint64_t(0x44DB015024623547), uint64_t(0x9C15F73E62A76AE2),
    uint64_t(0x75834465489C0C89), uint64_t(0x3290AC3A203001BF), uint64_t(0x0FBBAD1F61042279), uint64_t(0xE83A908FF2FB60CA),
    uint64_t(0x0D7E765D58755C10), uint64_t(0x1A083822CEAFE02D), uint64_t(0x9605D5F0E25EC3B0), uint64_t(0xD021FF5CD13A2ED5),
@@ -0,0 +1,51 @@
+#include "blunderfish.h"
+
+#define PARAM(name, lo, hi) { \
+    #name, lo, hi, std::is_integral_v<decltype(SearchParameters::name)>, \
+    [](const SearchParameters& p) { return float(p.name); }, \
+    [](SearchParameters& p, float v) { \
+        using T = decltype(SearchParameters::name); \
+        p.name = std::is_integral_v<T> ? T(std::round(v)) : T(v); \
+    } \
+}
+
+static const SearchParameterInfo parameters[] = {
+    PARAM(lmr_rate_base, 0.0f, 3.0f),
+    PARAM(lmr_rate_divisor, 0.5f, 5.0f),
+    PARAM(singular_margin_factor, 0.5f, 5.0f),
+    PARAM(rfp_margin_factor, 10.0f, 1000.0f),
+    PARAM(rfp_improving_bonus, 0.0f, 1000.0f),
+    PARAM(fp_margin_factor, 10.0f, 1000.0f),
+    PARAM(lmr_history_bonus_threshold, 100.0f, 5000.0f),
+    PARAM(history_bonus_factor, 0.1f, 5.0f),
+    PARAM(history_malus_factor, 0.1f, 5.0f),
+    PARAM(cont_history_bonus_factor, 0.1f, 5.0f),
+    PARAM(cont_history_malus_factor, 0.1f, 5.0f),
+    PARAM(capture_history_bonus_factor, 0.1f, 5.0f),
+    PARAM(capture_history_malus_factor, 0.1f, 5.0f),
+    PARAM(qsearch_big_delta, 400.0f, 2000.0f),
+    PARAM(qsearch_delta_margin, 50.0f, 1000.0f),
+    PARAM(asp_initial_window_size, 10.0f, 100.0f),
+    PARAM(asp_window_growth_factor, 1.1f, 100.0f),
+    PARAM(nmp_r_base, 1.0f, 6.0f),
+    PARAM(nmp_r_divisor, 1.0f, 12.0f),
+    PARAM(lmp_index_base, 1.0f, 5.0f),
+    PARAM(lmp_index_factor, 0.5f, 5.0f),
+    PARAM(probcut_margin, 50.0f, 500.0f),
+};
+
+#undef PARAM
+
+std::span<const SearchParameterInfo> search_parameter_table() {
+    return parameters;
+}
+
+const SearchParameterInfo* find_search_parameter(std::string_view name) {
+    for (const SearchParameterInfo& info : parameters) {
+        if (name == info.name) {
+            return &info;
+        }
+    }
+
+    return nullptr;
+}
@@ -254,6 +254,7 @@ std::optional<Position> Position::parse_fen(const std::string& fen) {
     }
 
     pos.zobrist = pos.compute_zobrist();
+    pos.polyglot = pos.compute_polyglot();
     pos.update_is_checked();
     pos.half_move_clock = half_move_clock;
 
@@ -420,10 +421,12 @@ void Position::reset_benchmarking_statistics() {
     pv_node_count = 0;
     beta_cutoffs = 0;
     null_prunes = 0;
+    probcut_prunes = 0;
     cutoff_index_count = 0;
     cutoff_index_sum = 0;
     reduced_searches = 0;
     reduced_fail_high = 0;
+    tb_hits = 0;
 }
 
 int Position::get_king_sq(int side) const {
@@ -0,0 +1,99 @@
+#include "blunderfish.h"
+
+PackedRecord pack_record(const std::array<uint64_t, 12>& bbs, int16_t score, int8_t max_ply, int8_t outcome) {
+    PackedRecord r = {};
+
+    for (uint64_t bb : bbs) {
+        r.occupancy |= bb;
+    }
+
+    int n = 0;
+
+    for (uint64_t occ = r.occupancy; occ && n < 32; occ &= occ - 1, ++n) {
+        uint64_t sq_bb = occ & -occ;
+
+        int idx = 0;
+        while (!(bbs[idx] & sq_bb)) {
+            ++idx;
+        }
+
+        r.pieces[n / 2] |= uint8_t(idx << (4 * (n % 2)));
+    }
+
+    r.score = score;
+    r.max_ply = max_ply;
+    r.outcome = outcome;
+
+    return r;
+}
+
+std::array<uint64_t, 12> unpack_bitboards(const PackedRecord& r) {
+    std::array<uint64_t, 12> bbs = {};
+
+    int n = 0;
+
+    for (uint64_t occ = r.occupancy; occ && n < 32; occ &= occ - 1, ++n) {
+        int idx = (r.pieces[n / 2] >> (4 * (n % 2))) & 0xf;
+        bbs[idx % 12] |= occ & -occ;
+    }
+
+    return bbs;
+}
+
+bool read_packed_header(FILE* file) {
+    PackedFileHeader header;
+
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+
+    return header.magic == PACKED_MAGIC
+        && header.version == PACKED_VERSION
+        && header.record_size == sizeof(PackedRecord);
+}
+
+bool RecordWriter::open(const std::string& path) {
+    close();
+
+    _file = fopen(path.c_str(), "wb");
+    _failed = false;
+
+    if (!_file) {
+        return false;
+    }
+
+    PackedFileHeader header = {
+        .magic = PACKED_MAGIC,
+        .version = PACKED_VERSION,
+        .record_size = sizeof(PackedRecord),
+        .reserved = 0,
+    };
+
+    if (fwrite(&header, sizeof(header), 1, _file) != 1) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool RecordWriter::close() {
+    if (_file) {
+        _failed |= fclose(_file) != 0;
+        _file = nullptr;
+    }
+
+    return !_failed;
+}
+
+void RecordWriter::write(std::span<const PackedRecord> records) {
+    if (records.empty()) {
+        return;
+    }
+
+    std::lock_guard g(_mutex);
+
+    if (_file && fwrite(records.data(), sizeof(PackedRecord), records.size(), _file) != records.size()) {
+        _failed = true;
+    }
+}
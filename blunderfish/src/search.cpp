@@ -10,10 +10,13 @@ constexpr int32_t BEST_MOVE_SCORE    = 2000000;
 constexpr int32_t GOOD_CAPTURE_SCORE = 900000;
 constexpr int32_t KILLER_1_SCORE     = 700000;
 constexpr int32_t KILLER_2_SCORE     = 600000;
+constexpr int32_t COUNTER_MOVE_SCORE = 500000;
 constexpr int32_t MAX_HISTORY_SCORE  = 80000;
 constexpr int32_t BAD_CAPTURE_SCORE  = -900000;
 
-constexpr uint64_t TT_MASK = TRANSPOSITION_TABLE_SIZE - 1;
+constexpr int32_t CORRECTION_LIMIT     = 1024;
+constexpr int32_t MAX_CORRECTION_BONUS = CORRECTION_LIMIT / 4;
+constexpr int32_t CORRECTION_DIVISOR   = 8; // the summed entries over this is the correction in centipawns
 
 //using LMRTable = std::array<std::array<int, 64>,64>;
 
@@ -44,7 +47,8 @@ enum TTScoreFlag {
     TT_SCORE_LOWER
 };
 
-static Move select_best(MoveList& moves, std::span<int32_t>& move_scores, int index) {
+// good_captures, when given, is kept in step with the moves
+static Move select_best(MoveList& moves, std::span<int32_t>& move_scores, int index, std::span<bool> good_captures = {}) {
     int32_t best_score = INT32_MIN;
     int best_index = -1;
 
@@ -62,6 +66,10 @@ static Move select_best(MoveList& moves, std::span<int32_t>& move_scores, int in
     std::swap(moves.data[index], moves.data[best_index]);
     std::swap(move_scores[index], move_scores[best_index]);
 
+    if (!good_captures.empty()) {
+        std::swap(good_captures[index], good_captures[best_index]);
+    }
+
     return moves.data[index];
 }
 
@@ -76,9 +84,14 @@ static uint32_t compress_zobrist(uint64_t zobrist) {
     return uint32_t(zobrist >> 32);
 }
 
-bool update_tt_entry(TTEntry& entry, uint64_t zobrist, int depth, int64_t score, int ply, int64_t alpha_original, int64_t beta_original, Move best_move) {
-    if (entry.key32 != compress_zobrist(zobrist) || depth > entry.depth) {
+bool update_tt_entry(TTEntry& entry, uint8_t generation, uint64_t zobrist, int depth, int64_t score, int ply, int64_t alpha_original, int64_t beta_original, Move best_move, int64_t static_eval) {
+    if (entry.key32 == compress_zobrist(zobrist) && static_eval == TT_EVAL_NONE) {
+        static_eval = entry.static_eval; // the eval belongs to the position, keep it for the new result
+    }
+
+    if (entry.key32 != compress_zobrist(zobrist) || depth > entry.depth || entry.generation != generation) {
         entry.key32 = compress_zobrist(zobrist);
+        entry.generation = generation;
 
         assert(depth <= UINT8_MAX);
         entry.depth = (uint8_t)depth;
@@ -86,11 +99,11 @@ bool update_tt_entry(TTEntry& entry, uint64_t zobrist, int depth, int64_t score,
         assert(int64_t(int16_t(score)) == score); // ensure the truncation preserves the score
         entry.score = int16_t(score);
 
-        if (entry.score < -MATE_SCORE + 1000) {
+        if (entry.score <= -DECISIVE_SCORE) {
             entry.score -= int16_t(ply);
         }
-        else if (entry.score > MATE_SCORE - 1000) {
-            entry.score += int16_t(ply); // remove the current ply so that the mate score is relative to here rather than the root
+        else if (entry.score >= DECISIVE_SCORE) {
+            entry.score += int16_t(ply); // remove the current ply so that the mate or tablebase score is relative to here rather than the root
         }
 
         if (score <= alpha_original) {
@@ -104,6 +117,7 @@ bool update_tt_entry(TTEntry& entry, uint64_t zobrist, int depth, int64_t score,
         }
 
         entry.best_move = best_move;
+        entry.static_eval = static_eval == TT_EVAL_NONE ? TT_EVAL_NONE : int16_t(std::clamp<int64_t>(static_eval, -INT16_MAX, INT16_MAX));
 
         return true;
     }
@@ -111,35 +125,142 @@ bool update_tt_entry(TTEntry& entry, uint64_t zobrist, int depth, int64_t score,
     return false;
 }
 
-static std::span<int32_t> compute_move_scores(Position* pos, HistoryTable& history, KillerTable& killers, int ply, std::span<int32_t> score_buf, const MoveList& moves, Move best_move, ContinuationTable* cont) {
+// mate and tablebase scores are stored relative to the entry's position, this makes them relative to the root again
+static int64_t tt_entry_score(const TTEntry& entry, int ply) {
+    int64_t score = int64_t(entry.score);
+
+    if (score <= -DECISIVE_SCORE) {
+        score += ply;
+    }
+    else if (score >= DECISIVE_SCORE) {
+        score -= ply;
+    }
+
+    return score;
+}
+
+static int32_t& capture_history_entry(SearchContext& s, const Position* pos, Move mv) {
+    return s.capture_history[pos->piece_at[move_from(mv)]][move_to(mv)][move_captured_piece(mv)];
+}
+
+// the counter move slot for the move that led here, nullptr at the root or after a null move
+static Move* counter_move_entry(SearchContext& s, int ply) {
+    const SearchStackFrame* prev = s.frame(ply - 1);
+
+    if (prev->move == NULL_MOVE) {
+        return nullptr;
+    }
+
+    return &s.counter_moves[prev->piece][prev->to];
+}
+
+// follow-up history of the moves 1, 2 and 4 plies back, entries are nullptr where there was no move
+static std::array<ContinuationTable*, 3> continuation_tables(SearchContext& s, int ply) {
+    return { s.frame(ply - 1)->reply_cont, s.frame(ply - 2)->follow_up_cont[0], s.frame(ply - 4)->follow_up_cont[1] };
+}
+
+static void set_frame_move(SearchContext& s, SearchStackFrame* ss, Move move, Piece piece, int to) {
+    ss->move = move;
+    ss->piece = piece;
+    ss->to = to;
+    ss->reply_cont = &s.cont_history[piece][to];
+    ss->follow_up_cont[0] = &s.follow_up_history[0][piece][to];
+    ss->follow_up_cont[1] = &s.follow_up_history[1][piece][to];
+}
+
+static uint64_t mix_bits(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// Correction history keys hash the bitboards directly, which is cheap enough to do per node
+static std::array<int32_t*, 3> correction_entries(SearchContext& s, const Position& pos) {
+    int stm = pos.to_move;
+
+    uint64_t pawn_key = mix_bits(pos.sides[WHITE].bb[PIECE_PAWN] ^ mix_bits(pos.sides[BLACK].bb[PIECE_PAWN]));
+    uint64_t non_pawn_keys[2];
+
+    for (int side = 0; side < 2; ++side) {
+        uint64_t key = 0;
+
+        for (int piece = PIECE_ROOK; piece <= PIECE_KING; ++piece) {
+            key = mix_bits(key ^ pos.sides[side].bb[piece]);
+        }
+
+        non_pawn_keys[side] = key;
+    }
+
+    return {
+        &s.pawn_correction[stm][pawn_key % CORRECTION_HISTORY_SIZE],
+        &s.non_pawn_correction[WHITE][stm][non_pawn_keys[WHITE] % CORRECTION_HISTORY_SIZE],
+        &s.non_pawn_correction[BLACK][stm][non_pawn_keys[BLACK] % CORRECTION_HISTORY_SIZE],
+    };
+}
+
+static int64_t corrected_eval(int64_t raw_eval, const std::array<int32_t*, 3>& entries) {
+    int64_t correction = 0;
+
+    for (int32_t* e : entries) {
+        correction += *e;
+    }
+
+    return std::clamp(raw_eval + correction / CORRECTION_DIVISOR, -DECISIVE_SCORE + 1, DECISIVE_SCORE - 1);
+}
+
+// moves every entry towards the error, deeper searches are trusted more
+static void update_corrections(const std::array<int32_t*, 3>& entries, int64_t error, int depth) {
+    int32_t bonus = int32_t(std::clamp<int64_t>(error * depth / 8, -MAX_CORRECTION_BONUS, MAX_CORRECTION_BONUS));
+
+    for (int32_t* e : entries) {
+        *e += bonus - *e * std::abs(bonus) / CORRECTION_LIMIT;
+    }
+}
+
+// good_captures receives, for every capture, whether it passes SEE; later decisions at the node reuse it
+static std::span<int32_t> compute_move_scores(Position* pos, SearchContext& s, int ply, std::span<int32_t> score_buf, std::span<bool> good_captures, const MoveList& moves, Move best_move) {
     std::span<int32_t> move_scores = score_buf.subspan(0, moves.count);
 
+    const SearchStackFrame* ss = s.frame(ply);
+    Move* counter_entry = counter_move_entry(s, ply);
+    Move counter = counter_entry ? *counter_entry : NULL_MOVE;
+    auto conts = continuation_tables(s, ply);
+
     for (int i = 0; i < moves.count; ++i) {
         Move mv = moves.data[i];
 
         bool quiet = !is_capture(mv);
+        good_captures[i] = !quiet && pos->see_ge(mv, 0);
 
         if (mv == best_move) {
             move_scores[i] = BEST_MOVE_SCORE;
         }
-        else if (mv == killers[ply][0]) {
+        else if (mv == ss->killers[0]) {
             move_scores[i] = KILLER_1_SCORE;
         }
-        else if (mv == killers[ply][1]) {
+        else if (mv == ss->killers[1]) {
             move_scores[i] = KILLER_2_SCORE;
         }
         else if (!quiet) {
-            int offset = pos->see(mv) < 0 ? BAD_CAPTURE_SCORE : GOOD_CAPTURE_SCORE;
-            move_scores[i] = pos->mvv_lva_score(mv, offset);
+            int offset = good_captures[i] ? GOOD_CAPTURE_SCORE : BAD_CAPTURE_SCORE;
+            move_scores[i] = pos->mvv_lva_score(mv, offset) + capture_history_entry(s, pos, mv);
+        }
+        else if (mv == counter) {
+            move_scores[i] = COUNTER_MOVE_SCORE;
         }
         else {
             Piece piece = (Piece)pos->piece_at[move_from(mv)];
             int to = move_to(mv);
 
-            int score = history[piece][to];
+            int score = s.history[piece][to];
 
-            if (cont) {
-                score += int(cont->at(piece)[to]);
+            for (const ContinuationTable* cont : conts) {
+                if (cont) {
+                    score += cont->at(piece)[to];
+                }
             }
 
             move_scores[i] = score;
@@ -149,14 +270,15 @@ static std::span<int32_t> compute_move_scores(Position* pos, HistoryTable& histo
     return move_scores;
 }
 
-#define PREFETCH_TT() PREFETCH(&s.tt[zobrist & TT_MASK])
+#define PREFETCH_TT() PREFETCH(&s.tt[zobrist & s.tt.mask])
 
 static TTEntry& find_entry(TranspositionTable& tt, uint64_t zobrist) {
-    TTCluster& cluster = tt[zobrist & TT_MASK];
+    TTCluster& cluster = tt[zobrist & tt.mask];
 
     // find match
     for (auto& e : cluster.entries) {
         if (e.key32 == compress_zobrist(zobrist)) {
+            e.generation = tt.generation; // still useful, keep it around
             return e;
         }
     }
@@ -168,10 +290,16 @@ static TTEntry& find_entry(TranspositionTable& tt, uint64_t zobrist) {
         }
     }
 
+    // replace the shallowest entry, where entries from older searches count as shallower
+    auto replace_value = [&](const TTEntry& e) {
+        int age = uint8_t(tt.generation - e.generation);
+        return int(e.depth) - 8 * age;
+    };
+
     size_t shallowest = 0;
 
     for (size_t i = 1; i < std::size(cluster.entries); ++i) {
-        if (cluster.entries[i].depth < cluster.entries[shallowest].depth) {
+        if (replace_value(cluster.entries[i]) < replace_value(cluster.entries[shallowest])) {
             shallowest = i;
         }
     }
@@ -179,7 +307,7 @@ static TTEntry& find_entry(TranspositionTable& tt, uint64_t zobrist) {
     return cluster.entries[shallowest];
 }
 
-int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null, int64_t alpha, int64_t beta, Move excluded_move, int extensions_so_far, int root_depth, ContinuationTable* cont) {
+int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null, int64_t alpha, int64_t beta, int extensions_so_far, int root_depth) {
     if ((node_count & 4095) == 0) {
         if (s.budgeter->should_exit(*this)) {
             s.should_stop = true;
@@ -208,12 +336,8 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
     int my_side = to_move;
     bool currently_checked = is_checked[my_side];
 
-    bool improving = false;
-    if (ply >= 2 && !currently_checked) {
-        improving = signed_eval() >= s.eval_history[ply-2];
-    }
-
-    s.eval_history[ply] = signed_eval();
+    SearchStackFrame* ss = s.frame(ply);
+    Move excluded_move = ss->excluded_move;
 
     // First check TT
 
@@ -226,14 +350,7 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
 
     if (match.key32 == compress_zobrist(zobrist)) { // exact match
         if (excluded_move == NULL_MOVE && match.depth >= depth) {
-            int64_t entry_score = int64_t(match.score);
-
-            if (entry_score < -MATE_SCORE + 1000) {
-                entry_score += ply;
-            }
-            else if (entry_score >  MATE_SCORE - 1000) {
-                entry_score -= ply; // reapply the ply to mate scores to restore them to relative to the root
-            }
+            int64_t entry_score = tt_entry_score(match, ply);
 
             switch (match.flag) {
                 case TT_SCORE_EXACT:
@@ -257,6 +374,48 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
         tt_move = match.best_move;
     }
 
+    // the static eval used for pruning, corrected by what earlier searches of similar positions found
+    // a TT entry with the raw eval spares the network's forward pass
+    bool tt_has_eval = match.key32 == compress_zobrist(zobrist) && match.static_eval != TT_EVAL_NONE;
+    int64_t raw_eval = tt_has_eval ? int64_t(match.static_eval) : signed_eval();
+
+    auto corrections = correction_entries(s, *this);
+    int64_t static_eval = corrected_eval(raw_eval, corrections);
+
+    bool improving = false;
+    if (ply >= 2 && !currently_checked) {
+        improving = static_eval >= s.frame(ply - 2)->static_eval;
+    }
+
+    ss->static_eval = static_eval;
+
+    // Tablebase probe
+    // the WDL tables don't know about castling rights or the 50-move counter, so only probe right after a zeroing move
+    if (excluded_move == NULL_MOVE && flags == 0 && half_move_clock == 0 && std::popcount(all_pieces()) <= s.tb_cardinality) {
+        bool success;
+        WDLScore wdl = tb_probe_wdl(*this, &success);
+
+        if (success) {
+            tb_hits++;
+
+            int64_t tb_score = wdl < WDL_BLESSED_LOSS ? -TB_WIN_SCORE + ply
+                             : wdl > WDL_CURSED_WIN   ?  TB_WIN_SCORE - ply
+                             : int64_t(wdl); // draws that hinge on the 50-move rule lean slightly
+
+            // a tablebase win is at least this good (we may find a mate), a loss at most this good
+            int64_t tb_alpha = wdl < WDL_BLESSED_LOSS ? tb_score : -INF;
+            int64_t tb_beta  = wdl > WDL_CURSED_WIN   ? tb_score :  INF;
+
+            bool is_exact = tb_alpha == -INF && tb_beta == INF;
+
+            if (is_exact || (tb_beta != INF && tb_score >= beta) || (tb_alpha != -INF && tb_score <= alpha)) {
+                TTEntry& target = find_entry(s.tt, zobrist);
+                update_tt_entry(target, s.tt.generation, zobrist, std::min(depth + 6, MAX_DEPTH - 1), tb_score, ply, tb_alpha, tb_beta, NULL_MOVE, raw_eval);
+                return tb_score;
+            }
+        }
+    }
+
     // Singular extensions
     // we do a narrow search while "banning" the TT move, which we expect to be the best move
     // if that search fails miserably, we can be confident that the TT move is essentially forced
@@ -273,7 +432,9 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
         int singular_margin = int(std::round(s.params.singular_margin_factor * float(depth)));
         int singular_beta = match.score - singular_margin;
 
-        int64_t exc_score = negamax(s, depth/2, ply, false, singular_beta-1, singular_beta, tt_move, extensions_so_far, root_depth, nullptr);
+        ss->excluded_move = tt_move;
+        int64_t exc_score = negamax(s, depth/2, ply, false, singular_beta-1, singular_beta, extensions_so_far, root_depth);
+        ss->excluded_move = NULL_MOVE;
 
         if (exc_score < singular_beta) {
             tt_is_singular = true; // no other move can even come close 
@@ -304,7 +465,7 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
 
         margin = std::max(int64_t(0), margin);
 
-        int64_t ev = signed_eval();
+        int64_t ev = static_eval;
 
         if (ev - margin >= beta) {
             beta_cutoffs++;
@@ -321,18 +482,23 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
     int R = int(std::round(s.params.nmp_r_base + float(depth) / s.params.nmp_r_divisor)); // we subtract this from depth to reduce the search depth
 
     if (depth > R + 1 && !skip_null) { 
+        ss->move = NULL_MOVE;
+        ss->reply_cont = nullptr;
+        ss->follow_up_cont[0] = nullptr;
+        ss->follow_up_cont[1] = nullptr;
+
         make_null_move(); 
 
         int64_t null_alpha = beta - 1; // we only care if it can beat it, not the actual score
         int64_t null_beta = beta;
         
-        int64_t score = -negamax(s, depth - 1 - R, ply + 1, false, -null_beta, -null_alpha, NULL_MOVE, extensions_so_far, root_depth, nullptr);
+        int64_t score = -negamax(s, depth - 1 - R, ply + 1, false, -null_beta, -null_alpha, extensions_so_far, root_depth);
 
         unmake_null_move();
 
         if (score >= beta) {
             TTEntry& target = find_entry(s.tt, zobrist);
-            bool changed = update_tt_entry(target, zobrist, depth, beta, ply, alpha_original, beta_original, NULL_MOVE);
+            bool changed = update_tt_entry(target, s.tt.generation, zobrist, depth, beta, ply, alpha_original, beta_original, NULL_MOVE, raw_eval);
             if (changed) { target.flag = TT_SCORE_LOWER; }
             beta_cutoffs++;
             null_prunes++;
@@ -340,15 +506,60 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
         }
     }
 
-    MoveList moves = generate_moves();
+    CheckInfo ci = check_info();
+    assert((ci.checkers != 0) == currently_checked);
+
+    MoveList moves = generate_moves(ci.pinned);
+
+    // ProbCut
+    // if a capture that wins enough material beats beta by a margin at reduced depth, the full search would almost surely fail high too
+
+    int64_t probcut_beta = beta + s.params.probcut_margin;
+    bool tt_refutes_probcut = match.key32 == compress_zobrist(zobrist) && match.depth >= depth - 3 && match.score < probcut_beta;
+
+    if (!is_pv && depth >= 5 && !currently_checked && excluded_move == NULL_MOVE && std::abs(beta) < MATE_SCORE - 1000 && !tt_refutes_probcut) {
+        for (Move m : moves) {
+            if (!is_capture(m) || !see_ge(m, int(probcut_beta - static_eval))) {
+                continue;
+            }
+
+            set_frame_move(s, ss, m, Piece(piece_at[move_from(m)]), move_to(m));
+
+            make_move(m);
+
+            int64_t score = -INF;
+
+            if (!is_checked[my_side]) {
+                // qsearch first, as it rejects most candidates far more cheaply
+                score = -quiescence(s, ply + 1, -probcut_beta, -probcut_beta + 1);
+
+                if (score >= probcut_beta) {
+                    score = -negamax(s, depth - 4, ply + 1, true, -probcut_beta, -probcut_beta + 1, extensions_so_far, root_depth);
+                }
+            }
+
+            unmake_move();
+
+            if (score >= probcut_beta && !s.should_stop) {
+                TTEntry& target = find_entry(s.tt, zobrist);
+                update_tt_entry(target, s.tt.generation, zobrist, depth - 3, score, ply, alpha_original, beta_original, m, raw_eval);
+                beta_cutoffs++;
+                probcut_prunes++;
+                return score;
+            }
+        }
+    }
 
     std::array<int32_t, 256> score_buf;
-    std::span<int32_t> move_scores = compute_move_scores(this, s.history, s.killers, ply, score_buf, moves, tt_move, cont);
+    std::array<bool, 256> good_captures;
+    std::span<int32_t> move_scores = compute_move_scores(this, s, ply, score_buf, good_captures, moves, tt_move);
+
+    auto conts = continuation_tables(s, ply);
 
     bool futility_prune = false;
     if (depth <= 3 && !currently_checked && (std::abs(alpha) < MATE_SCORE - 1000)) {
         int f_margin = depth * s.params.fp_margin_factor;
-        if (signed_eval() + f_margin <= alpha) {
+        if (static_eval + f_margin <= alpha) {
             futility_prune = true;
         }
     }
@@ -360,8 +571,11 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
     std::array<Move, 256> searched_quiets;
     int searched_quiet_count = 0;
 
+    std::array<Move, 256> searched_captures;
+    int searched_capture_count = 0;
+
     for (int mv_idx_raw = 0; mv_idx_raw < moves.count; ++mv_idx_raw) {
-        Move m = select_best(moves, move_scores, mv_idx_raw);
+        Move m = select_best(moves, move_scores, mv_idx_raw, good_captures);
 
         if (m == excluded_move) {
             continue;
@@ -373,23 +587,42 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
         bool cutoff = false;
         bool quiet = !is_capture(m);
 
-        ContinuationTable* next_cont = &s.cont_history[piece][to];
+        bool checking = gives_check(m, ci);
+
+        // pruned moves are dropped before they touch the board, so they are never tested for legality either
+        if (futility_prune && quiet && !checking) {
+            continue;
+        }
+
+        // Late move pruning
+
+        if (depth <= 4 && !currently_checked && quiet && !checking) {
+            int move_threshold = int(std::round(s.params.lmp_index_base + s.params.lmp_index_factor * float(depth * depth)));
+            if (move_index > move_threshold) { 
+                continue; 
+            }
+        }
+
+        // captures are reduced by how they have fared before, like quiets
+        int32_t move_history = quiet ? s.history[piece][to] : capture_history_entry(s, this, m);
+
+        set_frame_move(s, ss, m, piece, to);
 
         make_move(m);
 
         if (!is_checked[my_side]) {
             PREFETCH_TT();
 
-            bool gives_check = is_checked[opponent(my_side)];
+            assert(checking == is_checked[opponent(my_side)]);
 
             // Late move reduction
 
             int reduction = 0;
-            bool bad_capture = !quiet && (see(m) < 0);
+            bool bad_capture = !quiet && !good_captures[mv_idx_raw];
 
-            //bool is_killer = m == s.killers[ply][0] || m == s.killers[ply][1];
+            //bool is_killer = m == ss->killers[0] || m == ss->killers[1];
 
-            if (depth >= 2 && (quiet || bad_capture) && !currently_checked && move_index >= 3 && !gives_check/* && !is_killer*/) {
+            if (depth >= 2 && (quiet || bad_capture) && !currently_checked && move_index >= 3 && !checking/* && !is_killer*/) {
                 int idx = std::min(move_index, 63);
                 reduction = get_reduction(depth, idx, s.params);
 
@@ -397,11 +630,11 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
                     reduction = std::max(0, reduction - 1);
                 }
 
-                if (s.history[piece][to] > s.params.lmr_history_bonus_threshold) {
+                if (move_history > s.params.lmr_history_bonus_threshold) {
                     reduction = std::max(0, reduction - 1);
                 }
                 else
-                if (s.history[piece][to] < 0) {
+                if (move_history < 0) {
                     reduction++; // this move has historically been ass -> reduce ts
                 }
 
@@ -419,24 +652,9 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
                 reduction = std::min(reduction, std::max(0, depth - 2));
             }
 
-            if (futility_prune && quiet && !gives_check) {
-                unmake_move();
-                continue;
-            }
-
-            // Late move pruning
-
-            if (depth <= 4 && !currently_checked && quiet && !gives_check) {
-                int move_threshold = int(std::round(s.params.lmp_index_base + s.params.lmp_index_factor * float(depth * depth)));
-                if (move_index > move_threshold) { 
-                    unmake_move();
-                    continue; 
-                }
-            }
-
             int64_t score;
 
-            int check_ext = gives_check && (extensions_so_far < root_depth);
+            int check_ext = checking && (extensions_so_far < root_depth);
 
             if (move_index == 0) {
                 int ext = check_ext;
@@ -445,18 +663,18 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
                     ext = std::max(ext, 1);
                 }
 
-                score = -negamax(s, depth - 1 + ext, ply + 1, true, -beta, -alpha, NULL_MOVE, extensions_so_far + ext, root_depth, next_cont);
+                score = -negamax(s, depth - 1 + ext, ply + 1, true, -beta, -alpha, extensions_so_far + ext, root_depth);
             }
             else {
                 reduced_searches += reduction > 0;
 
                 // don't extend the null-window search
-                score = -negamax(s, depth - 1 - reduction, ply + 1, true, -alpha-1, -alpha, NULL_MOVE, extensions_so_far, root_depth, next_cont); // do null-window search
+                score = -negamax(s, depth - 1 - reduction, ply + 1, true, -alpha-1, -alpha, extensions_so_far, root_depth); // do null-window search
 
                 if (score > alpha) { // if beats alpha do full-window
                     reduced_fail_high += reduction > 0;
                     // DO extend the research
-                    score = -negamax(s, depth - 1 + check_ext, ply + 1, true, -beta, -alpha, NULL_MOVE, extensions_so_far + check_ext, root_depth, next_cont);
+                    score = -negamax(s, depth - 1 + check_ext, ply + 1, true, -beta, -alpha, extensions_so_far + check_ext, root_depth);
                 }
             }
 
@@ -480,9 +698,13 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
 
         if (cutoff) {
             if (quiet) {
-                if (m != s.killers[ply][0]) {
-                    s.killers[ply][1] = s.killers[ply][0];
-                    s.killers[ply][0] = m;
+                if (m != ss->killers[0]) {
+                    ss->killers[1] = ss->killers[0];
+                    ss->killers[0] = m;
+                }
+
+                if (Move* counter = counter_move_entry(s, ply)) {
+                    *counter = m;
                 }
 
                 {
@@ -491,10 +713,12 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
                     *hist = std::clamp(*hist, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
                 }
 
-                if (cont) {
-                    auto c = &cont->at(piece)[to];
-                    *c += int32_t(std::round(s.params.cont_history_bonus_factor * float(depth * depth)));
-                    *c = std::clamp(*c, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
+                for (ContinuationTable* cont : conts) {
+                    if (cont) {
+                        auto c = &cont->at(piece)[to];
+                        *c += int32_t(std::round(s.params.cont_history_bonus_factor * float(depth * depth)));
+                        *c = std::clamp(*c, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
+                    }
                 }
 
                 for (int i = 0; i < searched_quiet_count; ++i) { // we have a quiet cutoff, penalize all previous cutoffs in the history table
@@ -507,13 +731,26 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
                     *hist -= int(std::round(s.params.history_malus_factor * float(depth * depth)));
                     *hist = std::clamp(*hist, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
 
-                    if (cont) {
-                        auto c = &cont->at(punished_piece)[punished_to];
-                        *c -= int(std::round(s.params.cont_history_malus_factor * float(depth*depth)));
-                        *c = std::clamp(*c, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
+                    for (ContinuationTable* cont : conts) {
+                        if (cont) {
+                            auto c = &cont->at(punished_piece)[punished_to];
+                            *c -= int(std::round(s.params.cont_history_malus_factor * float(depth*depth)));
+                            *c = std::clamp(*c, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
+                        }
                     }
                 }
             }
+            else {
+                auto hist = &capture_history_entry(s, this, m);
+                *hist += int(std::round(s.params.capture_history_bonus_factor * float(depth * depth)));
+                *hist = std::clamp(*hist, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
+            }
+
+            for (int i = 0; i < searched_capture_count; ++i) { // captures tried first failed to cut, whatever kind of move did
+                auto hist = &capture_history_entry(s, this, searched_captures[i]);
+                *hist -= int(std::round(s.params.capture_history_malus_factor * float(depth * depth)));
+                *hist = std::clamp(*hist, -MAX_HISTORY_SCORE, MAX_HISTORY_SCORE);
+            }
 
             cutoff_index_count++;
             cutoff_index_sum += (move_index-1);
@@ -525,6 +762,9 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
             if (quiet) {
                 searched_quiets[searched_quiet_count++] = m;
             }
+            else {
+                searched_captures[searched_capture_count++] = m;
+            }
         }
     }
 
@@ -541,8 +781,17 @@ int64_t Position::negamax(SearchContext& s, int depth, int ply, bool allow_null,
         return 0; // we don't want to store this in the TT
     }
 
+    // Learn the static eval error, unless the bound says nothing about it or a capture decided the score
+    bool quiet_best = best_move == NULL_MOVE || !is_capture(best_move);
+    bool bound_informative = !(best_score >= beta_original && best_score <= static_eval)
+                          && !(best_score <= alpha_original && best_score >= static_eval);
+
+    if (!currently_checked && excluded_move == NULL_MOVE && quiet_best && bound_informative && !s.should_stop && std::abs(best_score) < DECISIVE_SCORE) {
+        update_corrections(corrections, best_score - static_eval, depth);
+    }
+
     TTEntry& target = find_entry(s.tt, zobrist);
-    update_tt_entry(target, zobrist, depth, best_score, ply, alpha_original, beta_original, best_move);
+    update_tt_entry(target, s.tt.generation, zobrist, depth, best_score, ply, alpha_original, beta_original, best_move, raw_eval);
 
     return best_score;
 }
@@ -568,8 +817,34 @@ int64_t Position::quiescence(SearchContext& s, int ply, int64_t alpha, int64_t b
     int side = to_move;
     bool currently_checked = is_checked[side];
 
+    int64_t alpha_original = alpha;
+
+    Move tt_move = NULL_MOVE;
+    int64_t raw_eval = TT_EVAL_NONE;
+
+    // any stored result is at least as deep as a quiescence search, so every entry may cut
+    TTEntry& match = find_entry(s.tt, zobrist);
+
+    if (match.key32 == compress_zobrist(zobrist)) {
+        int64_t entry_score = tt_entry_score(match, ply);
+
+        if (match.flag == TT_SCORE_EXACT
+            || (match.flag == TT_SCORE_LOWER && entry_score >= beta)
+            || (match.flag == TT_SCORE_UPPER && entry_score <= alpha)) {
+            beta_cutoffs++;
+            return entry_score;
+        }
+
+        tt_move = match.best_move;
+        raw_eval = match.static_eval;
+    }
+
+    if (raw_eval == TT_EVAL_NONE) {
+        raw_eval = signed_eval();
+    }
+
     int64_t best_score = -MATE_SCORE;
-    int64_t stand_pat = signed_eval();
+    int64_t stand_pat = raw_eval;
 
     uint64_t promotion_rank = side == WHITE ? RANK_7 : RANK_2;
     uint64_t pawns = sides[side].bb[PIECE_PAWN];
@@ -583,6 +858,10 @@ int64_t Position::quiescence(SearchContext& s, int ply, int64_t alpha, int64_t b
 
         if (alpha >= beta) {
             beta_cutoffs++;
+
+            TTEntry& target = find_entry(s.tt, zobrist);
+            update_tt_entry(target, s.tt.generation, zobrist, TT_DEPTH_QSEARCH, stand_pat, ply, alpha_original, beta, NULL_MOVE, raw_eval);
+
             return stand_pat;
         }
 
@@ -599,9 +878,18 @@ int64_t Position::quiescence(SearchContext& s, int ply, int64_t alpha, int64_t b
     for (int i = 0; i < moves.count; ++i) {
         Move mv = moves.data[i];
         move_scores[i] = mvv_lva_score(mv, 0);
+
+        if (is_capture(mv)) {
+            move_scores[i] += capture_history_entry(s, this, mv);
+        }
+
+        if (mv == tt_move) {
+            move_scores[i] = BEST_MOVE_SCORE;
+        }
     }
 
     bool legal_found = false;
+    Move best_move = NULL_MOVE;
 
     for (int i = 0; i < moves.count; ++i) {
         Move mv = select_best(moves, move_scores, i);
@@ -618,7 +906,7 @@ int64_t Position::quiescence(SearchContext& s, int ply, int64_t alpha, int64_t b
                 }
             }
 
-            if (see(mv) < 0) {
+            if (!see_ge(mv, 0)) {
                 continue;
             }
         }
@@ -628,12 +916,15 @@ int64_t Position::quiescence(SearchContext& s, int ply, int64_t alpha, int64_t b
         make_move(mv);
 
         if (!is_checked[side]) {
+            PREFETCH_TT();
+
             legal_found = true;
 
             int64_t score = -quiescence(s, ply+1, -beta, -alpha);
 
             if (score > best_score) {
                 best_score = score;
+                best_move = mv;
             }
 
             if (score > alpha) {
@@ -649,18 +940,23 @@ int64_t Position::quiescence(SearchContext& s, int ply, int64_t alpha, int64_t b
 
         if (cutoff) {
             beta_cutoffs++;
-            return best_score;
+            break;
         }
     }
 
     if (currently_checked && !legal_found) {
-        return -MATE_SCORE + ply; // checkmate
+        best_score = -MATE_SCORE + ply; // checkmate
     }
 
     if (half_move_clock == 100) {
         return 0;
     }
 
+    if (!s.should_stop) {
+        TTEntry& target = find_entry(s.tt, zobrist);
+        update_tt_entry(target, s.tt.generation, zobrist, TT_DEPTH_QSEARCH, best_score, ply, alpha_original, beta, best_move, raw_eval);
+    }
+
     return best_score;
 }
 
@@ -673,21 +969,28 @@ std::pair<Move, int64_t> Position::best_move_internal(SearchContext& s, MoveList
     Move best_move = NULL_MOVE;
 
     std::array<int32_t, 256> score_buf;
-    std::span<int32_t> move_scores = compute_move_scores(this, s.history, s.killers, ply, score_buf, moves, last_best_move, nullptr);
+    std::array<bool, 256> good_captures;
+    std::span<int32_t> move_scores = compute_move_scores(this, s, ply, score_buf, good_captures, moves, last_best_move);
+
+    SearchStackFrame* ss = s.frame(ply);
 
     for (int i = 0; i < moves.count; ++i) {
-        Move m = select_best(moves, move_scores, i);
+        Move m = select_best(moves, move_scores, i, good_captures);
 
         Piece piece = Piece(piece_at[move_from(m)]);
         int to = move_to(m);
 
-        ContinuationTable* cont = &s.cont_history[piece][to];
+        set_frame_move(s, ss, m, piece, to);
+
+        int nodes_before = node_count;
 
         make_move(m); // no need to filter for check here - assumes filtered moves given
         PREFETCH_TT();
-        int64_t score = -negamax(s, depth-1, ply+1, true, -beta, -alpha, NULL_MOVE, 0, depth-1, cont);
+        int64_t score = -negamax(s, depth-1, ply+1, true, -beta, -alpha, 0, depth-1);
         unmake_move();
 
+        s.root_move_nodes[move_from(m) * 64 + move_to(m)] += node_count - nodes_before;
+
         if (score > best_score) {
             best_score = score;
             best_move = m;
@@ -704,7 +1007,60 @@ std::pair<Move, int64_t> Position::best_move_internal(SearchContext& s, MoveList
     return {best_move, best_score};
 }
 
+std::vector<Move> Position::extract_pv(SearchContext& s, Move first_move, int max_length) {
+    uint64_t initial_zobrist = zobrist;
+    (void)initial_zobrist;
+
+    std::vector<Move> pv_list;
+    pv_list.push_back(first_move);
+    make_move(first_move);
+
+    std::unordered_set<uint64_t> seen;
+    seen.insert(zobrist);
+
+    for (int i = 1; i < max_length; ++i) {
+        TTEntry& entry = find_entry(s.tt, zobrist);
+
+        if (entry.key32 != compress_zobrist(zobrist)) {
+            break; // TT miss
+        }
+
+        if (entry.best_move == NULL_MOVE) {
+            break; // No TT move
+        }
+
+        if (!is_move_legal(entry.best_move)) {
+            break;
+        }
+
+        pv_list.push_back(entry.best_move);
+        make_move(entry.best_move);
+
+        if (seen.count(zobrist)) { // cycle
+            break;
+        }
+
+        seen.insert(zobrist);
+    }
+
+    for (size_t i = 0; i < pv_list.size(); ++i) {
+        unmake_move();
+    }
+
+    assert(zobrist == initial_zobrist);
+
+    return pv_list;
+}
+
 Move Position::best_move(int depth, std::atomic<bool>& should_stop, Budgeter* budgeter, const SearchParameters& params_in, bool enable_uci_info, int64_t* score_out) {
+    auto s = std::make_unique<SearchContext>(params_in, should_stop, budgeter);
+    return best_move(*s, depth, enable_uci_info, score_out);
+}
+
+/**
+    Iterative deepening search using a caller owned context, so that the TT survives between searches
+ */
+Move Position::best_move(SearchContext& s, int depth, bool enable_uci_info, int64_t* score_out, Move* ponder_out) {
     reset_benchmarking_statistics();
 
     MoveList moves = generate_moves();
@@ -714,127 +1070,167 @@ Move Position::best_move(int depth, std::atomic<bool>& should_stop, Budgeter* bu
         return NULL_MOVE;
     }
 
-    auto s = std::make_unique<SearchContext>(params_in, should_stop, budgeter);
+    s.new_search();
+
+    // Keep only the root moves that preserve the tablebase result
+    s.tb_cardinality = tb_cardinality();
+
+    if (flags == 0 && std::popcount(all_pieces()) <= s.tb_cardinality) {
+        int root_count = moves.count;
+        bool dtz_ranked;
+
+        if (tb_filter_root_moves(*this, moves, &dtz_ranked)) {
+            tb_hits += root_count;
+
+            if (dtz_ranked) {
+                s.tb_cardinality = 0; // the DTZ ranking already makes progress, the search just picks among the moves
+            }
+        }
+    }
 
     TimePoint start_time = Clock::now();
-    budgeter->init();
+    s.budgeter->init();
+
+    // one line per requested PV, lines[0] is the best move
+    int num_lines = std::clamp(s.multi_pv, 1, moves.count);
+
+    std::vector<Move> line_moves(size_t(num_lines), NULL_MOVE);
+    std::vector<int64_t> line_scores(size_t(num_lines), 0);
 
-    Move best_move = moves.data[0]; // have at least one move
-    int64_t best_score = 0;
+    line_moves[0] = moves.data[0]; // have at least one move
 
     for (int i = 1; i <= depth; ++i) {
-        int64_t window = s->params.asp_initial_window_size; // start the window small
+        // the effort of the best move is measured against this iteration alone
+        s.root_move_nodes = {};
+        int iteration_start_nodes = node_count;
+
+        for (int k = 0; k < num_lines; ++k) {
+            // the first line searches every move, later lines only the moves not claimed by an earlier line
+            MoveList remaining;
+            remaining.count = 0;
+
+            if (k > 0) {
+                for (Move m : moves) {
+                    if (std::find(line_moves.begin(), line_moves.begin() + k, m) == line_moves.begin() + k) {
+                        remaining.data[remaining.count++] = m;
+                    }
+                }
+            }
 
-        int64_t alpha = best_score - window;
-        int64_t beta  = best_score + window;
+            MoveList& root_moves = k == 0 ? moves : remaining;
 
-        while (true) {
-            auto [move, score] = best_move_internal(*s.get(), moves, i, best_move, alpha, beta);
+            int64_t window = s.params.asp_initial_window_size; // start the window small
 
-            if (s->should_stop) {
-                break;
-            }
+            int64_t alpha = line_scores[size_t(k)] - window;
+            int64_t beta  = line_scores[size_t(k)] + window;
 
-            if (score <= alpha) {
-                // fail low
-                alpha -= window;
-                window = int64_t(float(window) * s->params.asp_window_growth_factor);
-            }
-            else if (score >= beta) {
-                // fail high
-                best_move = move;
-                beta += window;
-                window = int64_t(float(window) * s->params.asp_window_growth_factor);
+            Move line_move = line_moves[size_t(k)];
+
+            while (true) {
+                auto [move, score] = best_move_internal(s, root_moves, i, line_move, alpha, beta);
+
+                if (s.should_stop) {
+                    break;
+                }
+
+                if (score <= alpha) {
+                    // fail low
+                    alpha -= window;
+                    window = int64_t(float(window) * s.params.asp_window_growth_factor);
+                }
+                else if (score >= beta) {
+                    // fail high
+                    line_move = move;
+                    beta += window;
+                    window = int64_t(float(window) * s.params.asp_window_growth_factor);
+                }
+                else {
+                    line_move = move;
+                    line_scores[size_t(k)] = score;
+                    break;
+                }
             }
-            else {
-                best_move = move;
-                best_score = score;
+
+            line_moves[size_t(k)] = line_move;
+
+            if (s.should_stop) {
                 break;
             }
         }
 
-        if (s->should_stop) {
+        if (s.should_stop) {
             break;
         }
 
+        // a later line can overtake an earlier one, keep them sorted best first
+        for (int k = 1; k < num_lines; ++k) {
+            for (int j = k; j > 0 && line_scores[size_t(j)] > line_scores[size_t(j - 1)]; --j) {
+                std::swap(line_scores[size_t(j)], line_scores[size_t(j - 1)]);
+                std::swap(line_moves[size_t(j)], line_moves[size_t(j - 1)]);
+            }
+        }
+
         // UCI output
 
         if (enable_uci_info) {
             double elapsed = double(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time).count())/1000.0;
             int nps = int(double(node_count)/elapsed);
 
-            std::string score_str;
-            if (std::abs(best_score) > MATE_SCORE - 1000) {
-                int moves_to_mate = int((MATE_SCORE - std::abs(best_score) + 1) / 2);
-                score_str = std::format("mate {}", best_score > 0 ? moves_to_mate : -moves_to_mate);
-            } else {
-                score_str = std::format("cp {}", best_score);
-            }
-            
             int64_t nnue_score = nnue_eval();
 
             if (to_move == BLACK) {
                 nnue_score *= -1;
             }
 
-            uint64_t initial_zobrist = zobrist;
-            (void)initial_zobrist;
-
-            // extract pv
-            std::vector<Move> pv_list;
-            pv_list.push_back(best_move);
-            make_move(best_move);
-
-            std::unordered_set<uint64_t> seen;
-            seen.insert(zobrist);
-
-            for (int i = 0; i < 50; ++i) {
-                TTEntry& entry = find_entry(s->tt, zobrist);
+            for (int k = 0; k < num_lines; ++k) {
+                int64_t line_score = line_scores[size_t(k)];
 
-                if (entry.key32 != compress_zobrist(zobrist)) {
-                    break; // TT miss
+                std::string score_str;
+                if (std::abs(line_score) > MATE_SCORE - 1000) {
+                    int moves_to_mate = int((MATE_SCORE - std::abs(line_score) + 1) / 2);
+                    score_str = std::format("mate {}", line_score > 0 ? moves_to_mate : -moves_to_mate);
+                } else {
+                    score_str = std::format("cp {}", line_score);
                 }
 
-                if (entry.best_move == NULL_MOVE) {
-                    break; // No TT move
-                }
+                std::vector<Move> pv_list = extract_pv(s, line_moves[size_t(k)]);
+                std::string pv_string;
 
-                if (!is_move_legal_slow(entry.best_move)) {
-                    break;
-                }
-
-                pv_list.push_back(entry.best_move);
-                make_move(entry.best_move);
+                for (size_t j = 0; j < pv_list.size(); ++j) {
+                    if (j > 0) {
+                        pv_string += " ";
+                    }
 
-                if (seen.count(zobrist)) { // cycle
-                    break;
+                    pv_string += to_uci_move(pv_list[j]);
                 }
 
-                seen.insert(zobrist);
+                std::cout << std::format("info depth {} seldepth {} multipv {} score {} nnuescore {} nodes {} nps {} tbhits {} time {} pv {}\n", i, max_ply, k + 1, score_str, nnue_score, node_count, nps, tb_hits, int(elapsed*1000.0), pv_string);
             }
+        }
 
-            std::string pv_string;
-
-            for (size_t i = 0; i < pv_list.size(); ++i) {
-                unmake_move();
-            }
-
-            assert(zobrist == initial_zobrist);
-
-            for (size_t i = 0; i < pv_list.size(); ++i) {
-                if (i > 0) {
-                    pv_string += " ";
-                }
+        Move best = line_moves[0];
 
-                pv_string += to_uci_move(pv_list[i]);
-            }
+        IterationInfo info = {
+            .depth = i,
+            .best_move = best,
+            .score = line_scores[0],
+            .best_move_effort = double(s.root_move_nodes[move_from(best) * 64 + move_to(best)]) / double(std::max(node_count - iteration_start_nodes, 1)),
+        };
 
-            std::cout << std::format("info depth {} seldepth {} score {} nnuescore {} nodes {} nps {} time {} pv {}\n", i, max_ply, score_str, nnue_score, node_count, nps, int(elapsed*1000.0), pv_string);
+        if (!s.budgeter->should_start_iteration(info)) {
+            break;
         }
     }
 
+    Move best_move = line_moves[0];
+
     if (score_out) {
-        *score_out = best_score;
+        *score_out = line_scores[0];
+    }
+
+    if (ponder_out) {
+        std::vector<Move> pv_list = extract_pv(s, best_move, 2);
+        *ponder_out = pv_list.size() > 1 ? pv_list[1] : NULL_MOVE;
     }
 
     return best_move;
@@ -844,11 +1240,11 @@ Move Position::best_move(int depth, std::atomic<bool>& should_stop, Budgeter* bu
     Chooses between an opening move and searching for best move
  */
 Move Position::think(int depth, std::atomic<bool>& should_stop, Budgeter* budgeter, const SearchParameters& params_in, bool enable_uci_info) {
-    uint64_t hash = encode_polyglot();
-    std::vector<PolyglotEntry> p_moves = probe_book(hash);
+    std::array<PolyglotEntry, MAX_BOOK_MOVES> entries;
+    size_t n = embedded_book().probe(encode_polyglot(), entries);
 
-    if (!p_moves.empty()) {
-        PolyglotEntry line = choose_move(p_moves);
+    if (n > 0) {
+        PolyglotEntry line = choose_move(std::span(entries.data(), n));
         Move move = decode_polyglot(line);
         assert(is_move_legal_slow(move));
         return move;
@@ -0,0 +1,119 @@
+#include "blunderfish.h"
+
+static GameResult adjudicated(int result) {
+    return GameResult {
+        .result = result,
+        .reason = GAME_RESULT_ADJUDICATED
+    };
+}
+
+GameResult play_selfplay_game(Position& pos, SearchContext* const contexts[2], int depth, const AdjudicationConfig& adjudication, const SelfPlayCallback& on_move) {
+    contexts[WHITE]->clear();
+
+    if (contexts[BLACK] != contexts[WHITE]) {
+        contexts[BLACK]->clear();
+    }
+
+    int win_streak = 0;
+    int winner = 0;
+    int draw_streak = 0;
+
+    // Terminal positions are recognized from the search itself, which already generates the legal moves,
+    // instead of a separate game_result() every ply
+    for (int ply = 0;; ++ply) {
+        if (pos.half_move_clock >= 100) {
+            std::optional<GameResult> result = pos.game_result(); // a mate on the last move still counts
+            return result.value_or(GameResult { .result = 0, .reason = GAME_RESULT_50_MOVE_RULE });
+        }
+
+        if (pos.is_threefold_repetition()) {
+            return GameResult {
+                .result = 0,
+                .reason = GAME_RESULT_3_FOLD_REPETITION
+            };
+        }
+
+        if (adjudication.use_tablebases && pos.flags == 0 && std::popcount(pos.all_pieces()) <= tb_cardinality()) {
+            bool success;
+            WDLScore wdl = tb_probe_wdl(pos, &success);
+
+            if (success) {
+                int stm_result = wdl == WDL_WIN ? 1 : wdl == WDL_LOSS ? -1 : 0; // cursed wins and blessed losses are draws under the 50 move rule
+                return adjudicated(pos.to_move == WHITE ? stm_result : -stm_result);
+            }
+        }
+
+        SearchContext& s = *contexts[pos.to_move];
+        s.should_stop = false;
+
+        int64_t score = 0;
+        Move move = pos.best_move(s, depth, false, &score);
+
+        if (move == NULL_MOVE) {
+            if (pos.is_checked[pos.to_move]) {
+                return GameResult {
+                    .result = pos.to_move == WHITE ? -1 : 1,
+                    .reason = GAME_RESULT_CHECKMATE
+                };
+            }
+
+            return GameResult {
+                .result = 0,
+                .reason = GAME_RESULT_STALEMATE
+            };
+        }
+
+        int64_t white_score = pos.to_move == WHITE ? score : -score;
+
+        if (on_move) {
+            on_move(pos, move, white_score);
+        }
+
+        if (std::abs(score) >= adjudication.resign_score) {
+            int side = white_score > 0 ? 1 : -1;
+            win_streak = side == winner ? win_streak + 1 : 1;
+            winner = side;
+        }
+        else {
+            win_streak = 0;
+        }
+
+        if (win_streak >= adjudication.resign_plies) {
+            return adjudicated(winner);
+        }
+
+        if (ply >= adjudication.draw_min_ply && std::abs(score) <= adjudication.draw_score) {
+            draw_streak++;
+        }
+        else {
+            draw_streak = 0;
+        }
+
+        if (draw_streak >= adjudication.draw_plies) {
+            return adjudicated(0);
+        }
+
+        pos.make_move(move);
+    }
+}
+
+const char* describe_game_result(const GameResult& result) {
+    switch (result.reason) {
+        case GAME_RESULT_CHECKMATE:
+            return result.result == 1 ? "White mates" : "Black mates";
+
+        case GAME_RESULT_STALEMATE:
+            return "Stalemate";
+
+        case GAME_RESULT_50_MOVE_RULE:
+            return "50 move rule";
+
+        case GAME_RESULT_3_FOLD_REPETITION:
+            return "Three-fold repetition";
+
+        case GAME_RESULT_ADJUDICATED:
+            return result.result == 1 ? "White wins by adjudication" : result.result == -1 ? "Black wins by adjudication" : "Draw by adjudication";
+    }
+
+    return "";
+}
@@ -0,0 +1,1245 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "blunderfish.h"
+
+// Syzygy tablebase probing, written for Blunderfish from the file format designed by
+// Ronald de Man. A table file holds one or more sub-tables (per side to move and, with
+// pawns, per file of the leading pawn). Each maps a position index to a Huffman coded
+// value; positions are indexed by placing groups of identical pieces on the board in a
+// mixed-radix number, with the board symmetries folded away first.
+
+namespace {
+
+constexpr int TB_MAX_PIECES = 7;
+
+// sub-table header flags
+constexpr uint8_t FLAG_DTZ_BLACK_STORED = 1;   // DTZ tables store only one side to move
+constexpr uint8_t FLAG_DTZ_MAPPED       = 2;   // DTZ values go through a per-result map
+constexpr uint8_t FLAG_DTZ_WIN_PLIES    = 4;   // wins are stored in plies rather than moves
+constexpr uint8_t FLAG_DTZ_LOSS_PLIES   = 8;
+constexpr uint8_t FLAG_DTZ_WIDE_MAP     = 16;  // map entries are 16 bits
+constexpr uint8_t FLAG_SINGLE_VALUE     = 128; // the whole sub-table is one value
+
+// Table files number pieces P=1 N=2 B=3 R=4 Q=5 K=6, with bit 3 set for the second colour
+constexpr int CODE_PAWN = 1;
+constexpr int CODE_KING = 6;
+static const Piece piece_of_code[7] = { PIECE_NONE, PIECE_PAWN, PIECE_KNIGHT, PIECE_BISHOP, PIECE_ROOK, PIECE_QUEEN, PIECE_KING };
+static const char* code_chars = " PNBRQK";
+
+inline int sq_file(int sq) { return sq & 7; }
+inline int sq_rank(int sq) { return sq >> 3; }
+inline int diagonal_side(int sq) { return sq_rank(sq) - sq_file(sq); } // < 0 below the a1-h8 diagonal
+inline int transpose(int sq) { return (sq_file(sq) << 3) | sq_rank(sq); }
+
+inline uint16_t read_le16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+inline uint32_t read_le32(const uint8_t* p) { return uint32_t(read_le16(p)) | (uint32_t(read_le16(p + 2)) << 16); }
+inline uint32_t read_be32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3]; }
+inline uint64_t read_be64(const uint8_t* p) { return (uint64_t(read_be32(p)) << 32) | read_be32(p + 4); }
+
+// Index encoding tables, filled once by init_index_tables()
+struct IndexTables {
+    uint64_t choose[TB_MAX_PIECES + 1][65];      // choose[k][n] = n over k
+    int triangle[64];                            // a1-d1-d4 triangle: b1 c1 d1 c2 d2 d3 off the diagonal, then a1 b2 c3 d4
+    int below_diagonal[64];                      // squares below the a1-h8 diagonal, in order
+    int kings[10][64];                           // both kings when no other piece is unique, by triangle of the first
+    int pawn_twist[64];                          // pawn squares ordered so the leading pawn sorts highest
+    uint64_t lead_pawn_base[TB_MAX_PIECES][64];  // [lead pawns - 1][square of the leading pawn]
+    uint64_t lead_pawn_count[TB_MAX_PIECES][4];  // [lead pawns - 1][file]
+};
+
+IndexTables ix;
+
+void init_index_tables() {
+    for (int n = 0; n <= 64; ++n) {
+        for (int k = 0; k <= TB_MAX_PIECES; ++k) {
+            ix.choose[k][n] = k == 0 ? 1 : n == 0 ? 0 : ix.choose[k - 1][n - 1] + ix.choose[k][n - 1];
+        }
+    }
+
+    static const int triangle_squares[10] = { 1, 2, 3, 10, 11, 19, 0, 9, 18, 27 };
+
+    for (int sq = 0, below = 0; sq < 64; ++sq) {
+        ix.triangle[sq] = -1;
+        ix.below_diagonal[sq] = diagonal_side(sq) < 0 ? below++ : -1;
+    }
+
+    for (int t = 0; t < 10; ++t) {
+        ix.triangle[triangle_squares[t]] = t;
+    }
+
+    // pairs with both kings on the diagonal are numbered last
+    int code = 0;
+    std::vector<std::pair<int, int>> diagonal_pairs;
+
+    for (int t = 0; t < 10; ++t) {
+        int k1 = triangle_squares[t];
+
+        for (int k2 = 0; k2 < 64; ++k2) {
+            ix.kings[t][k2] = -1;
+
+            bool touching = std::abs(sq_file(k1) - sq_file(k2)) <= 1 && std::abs(sq_rank(k1) - sq_rank(k2)) <= 1;
+
+            if (touching || (diagonal_side(k1) == 0 && diagonal_side(k2) > 0)) {
+                continue;
+            }
+
+            if (diagonal_side(k1) == 0 && diagonal_side(k2) == 0) {
+                diagonal_pairs.push_back({ t, k2 });
+            }
+            else {
+                ix.kings[t][k2] = code++;
+            }
+        }
+    }
+
+    for (auto [t, k2] : diagonal_pairs) {
+        ix.kings[t][k2] = code++;
+    }
+
+    // a2 h2 a3 h3 .. a7 h7 b2 g2 .. d7 e7 count down from 47
+    int twist = 47;
+
+    for (int f = 0; f < 4; ++f) {
+        for (int r = 1; r < 7; ++r) {
+            ix.pawn_twist[r * 8 + f] = twist--;
+            ix.pawn_twist[r * 8 + 7 - f] = twist--;
+        }
+    }
+
+    // the other leading pawns all have a lower twist than the leading one
+    for (int lead = 1; lead <= TB_MAX_PIECES; ++lead) {
+        for (int f = 0; f < 4; ++f) {
+            uint64_t count = 0;
+
+            for (int r = 1; r < 7; ++r) {
+                int sq = r * 8 + f;
+                ix.lead_pawn_base[lead - 1][sq] = count;
+                count += ix.choose[lead - 1][ix.pawn_twist[sq]];
+            }
+
+            ix.lead_pawn_count[lead - 1][f] = count;
+        }
+    }
+}
+
+// Canonical Huffman decoder over symbols that either stand for a value or expand into two symbols
+struct Decoder {
+    uint8_t flags = 0;
+    int single_value = 0;
+    int block_log2 = 0;
+    int span_log2 = 0;                 // a sparse index entry every 2^span_log2 values
+    int min_len = 0;
+    const uint8_t* first_symbol = nullptr; // LE uint16 per code length
+    const uint8_t* symbols = nullptr;      // 3 bytes per symbol: two 12 bit halves
+    const uint8_t* sparse_index = nullptr; // 6 byte entries: LE uint32 block, LE uint16 offset
+    const uint8_t* block_counts = nullptr; // LE uint16 per block: number of values minus one
+    const uint8_t* data = nullptr;
+    std::vector<uint64_t> code_floor;      // lowest code of each length, left aligned
+    std::vector<uint8_t> extra_values;     // values a symbol expands to, minus one
+    size_t sparse_bytes = 0, counts_bytes = 0, data_bytes = 0;
+
+    int left(int sym) const { return symbols[3 * sym] | ((symbols[3 * sym + 1] & 0xF) << 8); }
+    int right(int sym) const { return (symbols[3 * sym + 1] >> 4) | (symbols[3 * sym + 2] << 4); }
+
+    const uint8_t* read_header(const uint8_t* p, uint64_t num_values);
+    int value_at(uint64_t idx) const;
+};
+
+const uint8_t* Decoder::read_header(const uint8_t* p, uint64_t num_values) {
+    flags = p[0];
+
+    if (flags & FLAG_SINGLE_VALUE) {
+        single_value = p[1];
+        return p + 2;
+    }
+
+    block_log2 = p[1];
+    span_log2 = p[2];
+    uint32_t blocks = read_le32(p + 4);
+    uint32_t padded_blocks = blocks + p[3];
+    int max_len = p[8];
+    min_len = p[9];
+
+    int lengths = max_len - min_len + 1;
+    first_symbol = p + 10;
+
+    int num_symbols = read_le16(p + 10 + 2 * lengths);
+    symbols = p + 12 + 2 * lengths;
+
+    // codes of one length follow on from the longer ones: floor[l] = (floor[l + 1] + count[l + 1]) / 2
+    code_floor.assign(size_t(lengths), 0);
+
+    for (int i = lengths - 2; i >= 0; --i) {
+        uint64_t longer = read_le16(first_symbol + 2 * i) - read_le16(first_symbol + 2 * (i + 1));
+        code_floor[size_t(i)] = (code_floor[size_t(i) + 1] + longer) / 2;
+    }
+
+    for (int i = 0; i < lengths; ++i) {
+        code_floor[size_t(i)] <<= 64 - (min_len + i);
+    }
+
+    extra_values.assign(size_t(num_symbols), 0);
+    std::vector<bool> known(size_t(num_symbols), false);
+
+    auto count_extra = [&](auto& self, int sym) -> int {
+        if (!known[size_t(sym)]) {
+            known[size_t(sym)] = true;
+
+            if (right(sym) != 0xFFF) {
+                extra_values[size_t(sym)] = uint8_t(self(self, left(sym)) + self(self, right(sym)) + 1);
+            }
+        }
+
+        return extra_values[size_t(sym)];
+    };
+
+    for (int sym = 0; sym < num_symbols; ++sym) {
+        count_extra(count_extra, sym);
+    }
+
+    sparse_bytes = 6 * ((num_values + (1ULL << span_log2) - 1) >> span_log2);
+    counts_bytes = 2 * size_t(padded_blocks);
+    data_bytes = size_t(blocks) << block_log2;
+
+    return symbols + 3 * num_symbols + (num_symbols & 1);
+}
+
+int Decoder::value_at(uint64_t idx) const {
+    if (flags & FLAG_SINGLE_VALUE) {
+        return single_value;
+    }
+
+    // the sparse index points at the middle of its span, walk to the block holding idx
+    const uint8_t* entry = sparse_index + 6 * (idx >> span_log2);
+    uint32_t block = read_le32(entry);
+    int64_t offset = int64_t(read_le16(entry + 4)) + int64_t(idx & ((1ULL << span_log2) - 1)) - (int64_t(1) << (span_log2 - 1));
+
+    while (offset < 0) {
+        offset += read_le16(block_counts + 2 * --block) + 1;
+    }
+
+    while (offset > read_le16(block_counts + 2 * block)) {
+        offset -= read_le16(block_counts + 2 * block++) + 1;
+    }
+
+    const uint8_t* p = data + (size_t(block) << block_log2);
+    uint64_t code = read_be64(p);
+    p += 8;
+
+    int used = 0; // bits shifted out since the last refill
+    int sym;
+
+    for (;;) {
+        int len = min_len;
+
+        while (code < code_floor[size_t(len - min_len)]) {
+            ++len;
+        }
+
+        sym = read_le16(first_symbol + 2 * (len - min_len)) + int((code - code_floor[size_t(len - min_len)]) >> (64 - len));
+
+        if (offset <= extra_values[size_t(sym)]) {
+            break;
+        }
+
+        offset -= extra_values[size_t(sym)] + 1;
+        code <<= len;
+        used += len;
+
+        if (used >= 32) {
+            used -= 32;
+            code |= uint64_t(read_be32(p)) << used;
+            p += 4;
+        }
+    }
+
+    while (extra_values[size_t(sym)] != 0) {
+        int l = left(sym);
+
+        if (offset <= extra_values[size_t(l)]) {
+            sym = l;
+        }
+        else {
+            offset -= extra_values[size_t(l)] + 1;
+            sym = right(sym);
+        }
+    }
+
+    return left(sym);
+}
+
+// Insertion sort, groups hold at most a handful of squares
+template<typename Less>
+void sort_squares(int* first, int* last, Less less) {
+    for (int* i = first + 1; i < last; ++i) {
+        for (int* j = i; j > first && less(*j, *(j - 1)); --j) {
+            std::swap(*j, *(j - 1));
+        }
+    }
+}
+
+// One side to move (and leading pawn file) of a table
+struct SubTable {
+    int num_pieces = 0;
+    int codes[TB_MAX_PIECES] = {};              // piece codes in index order
+    int group_size[TB_MAX_PIECES] = {};         // at the first square of each group
+    uint64_t multiplier[TB_MAX_PIECES] = {};    // at the first square of each group
+    uint64_t num_values = 0;
+    uint16_t map_start[4] = {};                 // DTZ only, by wdl_map_slot()
+    Decoder decoder;
+
+    void init(const uint8_t* pieces, int shift, int lead_place, int second_place, int lead_file, bool unique_piece);
+    uint64_t index(int* sq) const;
+};
+
+void SubTable::init(const uint8_t* pieces, int shift, int lead_place, int second_place, int lead_file, bool unique_piece) {
+    for (int i = 0; i < num_pieces; ++i) {
+        codes[i] = (pieces[i] >> shift) & 0xF;
+        group_size[i] = 0;
+    }
+
+    bool pawns = lead_file >= 0;
+    int lead = 0;
+    int second = 0;
+
+    if (pawns) {
+        while (lead < num_pieces && codes[lead] == codes[0]) {
+            ++lead;
+        }
+
+        while (lead + second < num_pieces && (codes[lead + second] & 7) == CODE_PAWN) {
+            ++second;
+        }
+    }
+    else {
+        lead = unique_piece ? 3 : 2;
+    }
+
+    group_size[0] = lead;
+
+    if (second) {
+        group_size[lead] = second;
+    }
+
+    for (int i = lead + second; i < num_pieces; i += group_size[i]) {
+        for (int j = i; j < num_pieces && codes[j] == codes[i]; ++j) {
+            ++group_size[i];
+        }
+    }
+
+    // the leading group and the second pawn group sit where the header says, the rest follow in order
+    uint64_t size = 1;
+    int free_squares = 64 - lead - second;
+    int i = lead + second;
+
+    for (int place = 0; i < num_pieces || place == lead_place || place == second_place; ++place) {
+        if (place == lead_place) {
+            multiplier[0] = size;
+            size *= pawns ? ix.lead_pawn_count[lead - 1][lead_file] : unique_piece ? 31332 : 462;
+        }
+        else if (place == second_place) {
+            multiplier[lead] = size;
+            size *= ix.choose[second][48 - lead];
+        }
+        else {
+            multiplier[i] = size;
+            size *= ix.choose[group_size[i]][free_squares];
+            free_squares -= group_size[i];
+            i += group_size[i];
+        }
+    }
+
+    num_values = size;
+}
+
+// sq[] holds the squares in the order of codes[], for pawn tables with the leading pawn first
+uint64_t SubTable::index(int* sq) const {
+    bool pawns = (codes[0] & 7) == CODE_PAWN;
+    int lead = group_size[0];
+    uint64_t idx;
+
+    if (sq_file(sq[0]) > 3) {
+        for (int i = 0; i < num_pieces; ++i) {
+            sq[i] ^= 7;
+        }
+    }
+
+    if (pawns) {
+        sort_squares(sq + 1, sq + lead, [](int a, int b) { return ix.pawn_twist[a] > ix.pawn_twist[b]; });
+
+        idx = ix.lead_pawn_base[lead - 1][sq[0]];
+
+        for (int i = 1; i < lead; ++i) {
+            idx += ix.choose[lead - i][ix.pawn_twist[sq[i]]];
+        }
+    }
+    else {
+        if (sq_rank(sq[0]) > 3) {
+            for (int i = 0; i < num_pieces; ++i) {
+                sq[i] ^= 56;
+            }
+        }
+
+        // the first leading piece off the diagonal decides whether to flip along it
+        for (int i = 0; i < lead; ++i) {
+            if (diagonal_side(sq[i]) == 0) {
+                continue;
+            }
+
+            if (diagonal_side(sq[i]) > 0) {
+                for (int j = 0; j < num_pieces; ++j) {
+                    sq[j] = transpose(sq[j]);
+                }
+            }
+
+            break;
+        }
+
+        if (lead == 2) {
+            idx = uint64_t(ix.kings[ix.triangle[sq[0]]][sq[1]]);
+        }
+        else {
+            // three unique pieces: first by how many of them are on the diagonal
+            int a = sq[0], b = sq[1], c = sq[2];
+            int b_adj = b > a;
+            int c_adj = (c > a) + (c > b);
+
+            if (diagonal_side(a)) {
+                idx = uint64_t(ix.triangle[a] * 63 * 62 + (b - b_adj) * 62 + (c - c_adj));
+            }
+            else if (diagonal_side(b)) {
+                idx = uint64_t(6 * 63 * 62 + sq_rank(a) * 28 * 62 + ix.below_diagonal[b] * 62 + (c - c_adj));
+            }
+            else if (diagonal_side(c)) {
+                idx = uint64_t(6 * 63 * 62 + 4 * 28 * 62 + sq_rank(a) * 7 * 28 + (sq_rank(b) - b_adj) * 28 + ix.below_diagonal[c]);
+            }
+            else {
+                idx = uint64_t(6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + sq_rank(a) * 7 * 6 + (sq_rank(b) - b_adj) * 6 + (sq_rank(c) - c_adj));
+            }
+        }
+    }
+
+    idx *= multiplier[0];
+
+    // every other group is a combination of the squares the earlier groups left free
+    for (int i = lead; i < num_pieces; i += group_size[i]) {
+        int end = i + group_size[i];
+        int skip = pawns && i == lead && (codes[i] & 7) == CODE_PAWN ? 8 : 0; // no pawns on the first rank
+
+        sort_squares(sq + i, sq + end, [](int a, int b) { return a < b; });
+
+        uint64_t combination = 0;
+
+        for (int j = i; j < end; ++j) {
+            int taken = 0;
+
+            for (int k = 0; k < i; ++k) {
+                taken += sq[k] < sq[j];
+            }
+
+            combination += ix.choose[j - i + 1][sq[j] - taken - skip];
+        }
+
+        idx += combination * multiplier[i];
+    }
+
+    return idx;
+}
+
+struct Table {
+    std::string name;       // e.g. KRvK, the first colour is the one before the 'v'
+    bool is_dtz = false;
+    uint64_t key = 0;       // material key with the first colour as white
+    uint64_t mirrored_key = 0;
+    int num_pieces = 0;
+    bool symmetric = false;
+    bool has_pawns = false;
+    bool unique_piece = false;
+    int pawn_colours = 0;
+
+    std::atomic<bool> loaded = false;
+    MappedFile file;
+    const uint8_t* dtz_map = nullptr;
+    SubTable sub[4][2];     // [file of the leading pawn][side to move]
+
+    bool parse();
+};
+
+// 4 bits per piece type and colour, kings left out
+uint64_t material_key(const int counts[2][7], bool mirrored) {
+    uint64_t key = 0;
+
+    for (int c = 0; c < 2; ++c) {
+        for (int t = 1; t < CODE_KING; ++t) {
+            key |= uint64_t(counts[mirrored ? 1 - c : c][t]) << (4 * (5 * c + t - 1));
+        }
+    }
+
+    return key;
+}
+
+uint64_t material_key(const Position& pos) {
+    int counts[2][7] = {};
+
+    for (int c = 0; c < 2; ++c) {
+        for (int t = 1; t < CODE_KING; ++t) {
+            counts[c][t] = std::popcount(pos.sides[c].bb[piece_of_code[t]]);
+        }
+    }
+
+    return material_key(counts, false);
+}
+
+bool Table::parse() {
+    const uint8_t* base = file.data();
+    const uint8_t* end = base + file.size();
+    const uint8_t* p = base + 5; // magic and a flags byte that the material already tells us
+
+    int files = has_pawns ? 4 : 1;
+    int sides = is_dtz || symmetric ? 1 : 2;
+
+    for (int f = 0; f < files; ++f) {
+        // with pawns on both sides a second order nibble places the second pawn group
+        int order_bytes = pawn_colours == 2 ? 2 : 1;
+
+        const uint8_t* pieces = p + order_bytes;
+
+        for (int s = 0; s < sides; ++s) {
+            int shift = 4 * s;
+            int lead_place = (p[0] >> shift) & 0xF;
+            int second_place = order_bytes == 2 ? (p[1] >> shift) & 0xF : -1;
+
+            sub[f][s].num_pieces = num_pieces;
+            sub[f][s].init(pieces, shift, lead_place, second_place, has_pawns ? f : -1, unique_piece);
+        }
+
+        p = pieces + num_pieces;
+    }
+
+    p += (p - base) & 1;
+
+    for (int f = 0; f < files; ++f) {
+        for (int s = 0; s < sides; ++s) {
+            p = sub[f][s].decoder.read_header(p, sub[f][s].num_values);
+        }
+    }
+
+    if (is_dtz) {
+        dtz_map = p;
+
+        for (int f = 0; f < files; ++f) {
+            uint8_t flags = sub[f][0].decoder.flags;
+
+            if (!(flags & FLAG_DTZ_MAPPED) || (flags & FLAG_SINGLE_VALUE)) {
+                continue;
+            }
+
+            // one run per result, each prefixed by its length
+            if (flags & FLAG_DTZ_WIDE_MAP) {
+                p += (p - base) & 1;
+
+                for (int i = 0; i < 4; ++i) {
+                    sub[f][0].map_start[i] = uint16_t((p - dtz_map) / 2 + 1);
+                    p += 2 * read_le16(p) + 2;
+                }
+            }
+            else {
+                for (int i = 0; i < 4; ++i) {
+                    sub[f][0].map_start[i] = uint16_t(p - dtz_map + 1);
+                    p += *p + 1;
+                }
+            }
+        }
+
+        p += (p - base) & 1;
+    }
+
+    for (int f = 0; f < files; ++f) {
+        for (int s = 0; s < sides; ++s) {
+            sub[f][s].decoder.sparse_index = p;
+            p += sub[f][s].decoder.sparse_bytes;
+        }
+    }
+
+    for (int f = 0; f < files; ++f) {
+        for (int s = 0; s < sides; ++s) {
+            sub[f][s].decoder.block_counts = p;
+            p += sub[f][s].decoder.counts_bytes;
+        }
+    }
+
+    for (int f = 0; f < files; ++f) {
+        for (int s = 0; s < sides; ++s) {
+            if (sub[f][s].decoder.data_bytes) {
+                p += (64 - (p - base) % 64) % 64;
+            }
+
+            sub[f][s].decoder.data = p;
+            p += sub[f][s].decoder.data_bytes;
+        }
+    }
+
+    return p <= end;
+}
+
+std::vector<std::string> tb_paths;
+std::deque<Table> tables;
+std::unordered_map<uint64_t, std::pair<Table*, Table*>> tables_by_key; // WDL and DTZ
+int max_pieces = 0;
+int probe_limit = TB_MAX_PIECES;
+
+bool open_in_paths(MappedFile& file, const std::string& name) {
+    for (const std::string& dir : tb_paths) {
+        if (file.open(dir + "/" + name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool exists_in_paths(const std::string& name) {
+    for (const std::string& dir : tb_paths) {
+        if (FILE* f = fopen((dir + "/" + name).c_str(), "rb")) {
+            fclose(f);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void init_table(Table& t, const std::string& name, bool is_dtz) {
+    int counts[2][7] = {};
+    int colour = 0;
+
+    for (char ch : name) {
+        if (ch == 'v') {
+            colour = 1;
+        }
+        else {
+            counts[colour][strchr(code_chars, ch) - code_chars]++;
+        }
+    }
+
+    t.name = name;
+    t.is_dtz = is_dtz;
+    t.key = material_key(counts, false);
+    t.mirrored_key = material_key(counts, true);
+    t.num_pieces = int(name.size()) - 1;
+    t.symmetric = t.key == t.mirrored_key;
+    t.pawn_colours = (counts[0][CODE_PAWN] > 0) + (counts[1][CODE_PAWN] > 0);
+    t.has_pawns = t.pawn_colours > 0;
+
+    for (int c = 0; c < 2; ++c) {
+        for (int code = 1; code < CODE_KING; ++code) {
+            t.unique_piece |= counts[c][code] == 1;
+        }
+    }
+}
+
+// Tries both colour orders, the file is named after whichever side the generator put first
+void add_material(const std::string& a, const std::string& b) {
+    for (const std::string& name : { "K" + a + "vK" + b, "K" + b + "vK" + a }) {
+        if (!exists_in_paths(name + ".rtbw")) {
+            continue;
+        }
+
+        Table& wdl = tables.emplace_back();
+        Table& dtz = tables.emplace_back();
+        init_table(wdl, name, false);
+        init_table(dtz, name, true);
+
+        tables_by_key[wdl.key] = { &wdl, &dtz };
+        tables_by_key[wdl.mirrored_key] = { &wdl, &dtz };
+        max_pieces = std::max(wdl.num_pieces, max_pieces);
+        return;
+    }
+}
+
+// Every multiset of up to n non-king pieces, strongest first
+void piece_sets(std::vector<std::string>& out, std::string prefix, int first, int n) {
+    out.push_back(prefix);
+
+    if (n == 0) {
+        return;
+    }
+
+    for (int code = first; code >= CODE_PAWN; --code) {
+        piece_sets(out, prefix + code_chars[code], code, n - 1);
+    }
+}
+
+bool load(Table& t) {
+    static std::mutex mutex;
+
+    if (t.loaded.load(std::memory_order_acquire)) {
+        return t.file.is_open();
+    }
+
+    std::lock_guard lock(mutex);
+
+    if (t.loaded.load(std::memory_order_relaxed)) {
+        return t.file.is_open();
+    }
+
+    static const uint8_t wdl_magic[4] = { 0x71, 0xE8, 0x23, 0x5D };
+    static const uint8_t dtz_magic[4] = { 0xD7, 0x66, 0x0C, 0xA5 };
+
+    if (open_in_paths(t.file, t.name + (t.is_dtz ? ".rtbz" : ".rtbw"))) {
+        // data blocks are 64 byte aligned and followed by a 16 byte checksum
+        bool valid = t.file.size() % 64 == 16 && memcmp(t.file.data(), t.is_dtz ? dtz_magic : wdl_magic, 4) == 0;
+
+        if (!valid || !t.parse()) {
+            t.file.close();
+        }
+    }
+
+    t.loaded.store(true, std::memory_order_release);
+    return t.file.is_open();
+}
+
+// Looks the position up in a table: the sub-table for the side to move and its index
+struct Lookup {
+    const SubTable* sub;
+    uint64_t idx;
+    int side; // side to move in the table's colours
+};
+
+Lookup locate(const Position& pos, const Table& t) {
+    // the table's first colour plays white, symmetric tables always have their first colour to move
+    bool swap = t.symmetric ? pos.to_move == BLACK : material_key(pos) != t.key;
+    int side = t.symmetric ? 0 : pos.to_move ^ int(swap);
+    int flip = swap ? 56 : 0;
+
+    int sq[TB_MAX_PIECES];
+    int f = 0;
+
+    if (t.has_pawns) {
+        // the leading pawn is the one closest to the a/h file, then to the first rank
+        int code = t.sub[0][0].codes[0];
+        uint64_t bb = pos.sides[(code >> 3) ^ int(swap)].bb[PIECE_PAWN];
+        int best = -1;
+
+        while (bb) {
+            int s = std::countr_zero(bb) ^ flip;
+            bb &= bb - 1;
+
+            if (best < 0 || ix.pawn_twist[s] > ix.pawn_twist[best]) {
+                best = s;
+            }
+        }
+
+        f = std::min(sq_file(best), 7 - sq_file(best));
+    }
+
+    const SubTable& sub = t.sub[f][t.is_dtz || t.symmetric ? 0 : side];
+    // identical pieces are listed together, so each bitboard fills one group
+    for (int n = 0; n < sub.num_pieces;) {
+        int code = sub.codes[n];
+        uint64_t bb = pos.sides[(code >> 3) ^ int(swap)].bb[piece_of_code[code & 7]];
+
+        while (bb) {
+            sq[n++] = std::countr_zero(bb) ^ flip;
+            bb &= bb - 1;
+        }
+    }
+
+    if (t.has_pawns) {
+        // move the leading pawn to the front of its group
+        int lead = 0;
+
+        for (int i = 1; i < sub.group_size[0]; ++i) {
+            if (ix.pawn_twist[sq[i]] > ix.pawn_twist[sq[lead]]) {
+                lead = i;
+            }
+        }
+
+        std::swap(sq[0], sq[lead]);
+    }
+
+    return { &sub, sub.index(sq), side };
+}
+
+Table* find_table(const Position& pos, bool dtz) {
+    auto it = tables_by_key.find(material_key(pos));
+
+    if (it == tables_by_key.end()) {
+        return nullptr;
+    }
+
+    Table* t = dtz ? it->second.second : it->second.first;
+    return load(*t) ? t : nullptr;
+}
+
+int count_pieces(const Position& pos) {
+    return std::popcount(pos.all_pieces());
+}
+
+// WDL straight from the table, correct unless a capture (or en passant) does better
+int table_wdl(const Position& pos, bool* ok) {
+    if (count_pieces(pos) == 2) {
+        return WDL_DRAW;
+    }
+
+    Table* t = find_table(pos, false);
+
+    if (!t) {
+        *ok = false;
+        return WDL_DRAW;
+    }
+
+    Lookup l = locate(pos, *t);
+    return l.sub->decoder.value_at(l.idx) - 2;
+}
+
+// DTZ tables don't hold the zeroing move itself: a win that zeroes right away is 1 ply from it
+int dtz_of_zeroing(int wdl) {
+    static const int dtz[5] = { -1, -101, 0, 101, 1 };
+    return dtz[wdl + 2];
+}
+
+int wdl_map_slot(int wdl) {
+    static const int slot[5] = { 1, 3, 0, 2, 0 };
+    return slot[wdl + 2];
+}
+
+// Plies to the next zeroing move from the table, or false in *stored when the table
+// only holds the other side to move
+int table_dtz(const Position& pos, int wdl, bool* ok, bool* stored) {
+    Table* t = find_table(pos, true);
+
+    if (!t) {
+        *ok = false;
+        return 0;
+    }
+
+    Lookup l = locate(pos, *t);
+    const Decoder& d = l.sub->decoder;
+
+    *stored = (d.flags & FLAG_DTZ_BLACK_STORED) == l.side || (t->symmetric && !t->has_pawns);
+
+    if (!*stored) {
+        return 0;
+    }
+
+    int value = d.value_at(l.idx);
+
+    if (d.flags & FLAG_DTZ_MAPPED) {
+        int start = l.sub->map_start[wdl_map_slot(wdl)];
+
+        value = d.flags & FLAG_DTZ_WIDE_MAP ? read_le16(t->dtz_map + 2 * (start + value)) : t->dtz_map[start + value];
+    }
+
+    bool in_plies = (wdl == WDL_WIN && (d.flags & FLAG_DTZ_WIN_PLIES)) || (wdl == WDL_LOSS && (d.flags & FLAG_DTZ_LOSS_PLIES));
+
+    if (!in_plies) {
+        value *= 2;
+    }
+
+    int dtz = value + 1 + (wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS ? 100 : 0);
+    return wdl > 0 ? dtz : -dtz;
+}
+
+MoveList legal_moves(Position& pos) {
+    MoveList moves = pos.generate_moves();
+    pos.filter_moves(moves);
+    return moves;
+}
+
+bool is_en_passant(Move m) {
+    return move_type(m) == MOVE_EN_PASSANT;
+}
+
+// Table values are only reliable where no capture is best, so captures other than en
+// passant are searched alongside the probe as a small alpha-beta over WDL values.
+// *capture_best is set when a capture wins and does at least as well as the table.
+int wdl_without_ep(Position& pos, int alpha, int beta, bool* ok, bool* capture_best) {
+    bool child_capture;
+
+    for (Move m : legal_moves(pos)) {
+        if (!is_capture(m) || is_en_passant(m)) {
+            continue;
+        }
+
+        pos.make_move(m);
+        int value = -wdl_without_ep(pos, -beta, -alpha, ok, &child_capture);
+        pos.unmake_move();
+
+        if (!*ok) {
+            return WDL_DRAW;
+        }
+
+        if (value > alpha) {
+            if (value >= beta) {
+                *capture_best = true;
+                return value;
+            }
+
+            alpha = value;
+        }
+    }
+
+    int value = table_wdl(pos, ok);
+
+    if (!*ok) {
+        return WDL_DRAW;
+    }
+
+    if (alpha >= value) {
+        *capture_best = alpha > WDL_DRAW;
+        return alpha;
+    }
+
+    *capture_best = false;
+    return value;
+}
+
+// Best WDL over the en passant captures, or INT_MIN without any. *only is set when they
+// are the only legal moves, in which case the tables know nothing about the position.
+int wdl_of_ep(Position& pos, bool* ok, bool* only) {
+    int best = INT_MIN;
+    bool capture_best;
+
+    MoveList moves = legal_moves(pos);
+    int ep_moves = 0;
+
+    for (Move m : moves) {
+        if (!is_en_passant(m)) {
+            continue;
+        }
+
+        ep_moves++;
+
+        pos.make_move(m);
+        int value = -wdl_without_ep(pos, WDL_LOSS, WDL_WIN, ok, &capture_best);
+        pos.unmake_move();
+
+        if (!*ok) {
+            return WDL_DRAW;
+        }
+
+        best = std::max(value, best);
+    }
+
+    *only = ep_moves > 0 && ep_moves == moves.count;
+    return best;
+}
+
+// Tables ignore en passant rights, so en passant captures are tried on top of the probe
+int probe_wdl(Position& pos, bool* ok) {
+    bool capture_best;
+    int value = wdl_without_ep(pos, WDL_LOSS, WDL_WIN, ok, &capture_best);
+
+    if (!*ok || pos.en_passant_sq == NULL_SQUARE) {
+        return value;
+    }
+
+    bool only_ep;
+    int ep_value = wdl_of_ep(pos, ok, &only_ep);
+
+    return ep_value != INT_MIN && (ep_value > value || only_ep) ? ep_value : value;
+}
+
+bool is_mate(Position& pos) {
+    return pos.is_checked[pos.to_move] && legal_moves(pos).count == 0;
+}
+
+int probe_dtz(Position& pos, bool* ok);
+
+int dtz_without_ep(Position& pos, bool* ok) {
+    bool capture_best;
+    int wdl = wdl_without_ep(pos, WDL_LOSS, WDL_WIN, ok, &capture_best);
+
+    if (!*ok || wdl == WDL_DRAW) {
+        return 0;
+    }
+
+    if (capture_best) {
+        return dtz_of_zeroing(wdl);
+    }
+
+    MoveList moves = legal_moves(pos);
+
+    // a winning pawn move zeroes the counter as well
+    if (wdl > 0) {
+        for (Move m : moves) {
+            if (is_capture(m) || pos.piece_at[move_from(m)] != PIECE_PAWN) {
+                continue;
+            }
+
+            pos.make_move(m);
+            int value = -probe_wdl(pos, ok);
+            pos.unmake_move();
+
+            if (!*ok) {
+                return 0;
+            }
+
+            if (value == wdl) {
+                return dtz_of_zeroing(wdl);
+            }
+        }
+    }
+
+    bool stored;
+    int dtz = table_dtz(pos, wdl, ok, &stored);
+
+    if (!*ok || stored) {
+        return dtz;
+    }
+
+    // the table only stores the other side to move, so look one ply ahead
+    if (wdl > 0) {
+        int best = INT_MAX;
+
+        for (Move m : moves) {
+            if (is_capture(m) || pos.piece_at[move_from(m)] == PIECE_PAWN) {
+                continue;
+            }
+
+            pos.make_move(m);
+            int value = -probe_dtz(pos, ok);
+            pos.unmake_move();
+
+            if (!*ok) {
+                return 0;
+            }
+
+            if (value > 0) {
+                best = std::min(value + 1, best);
+            }
+        }
+
+        return best;
+    }
+
+    int best = -1;
+
+    for (Move m : moves) {
+        pos.make_move(m);
+
+        int value;
+
+        if (pos.half_move_clock == 0) {
+            // a zeroing move keeps a blessed loss blessed only if the opponent can't win outright
+            value = wdl == WDL_LOSS ? -1 : probe_wdl(pos, ok) == WDL_WIN ? 0 : -101;
+        }
+        else {
+            value = -probe_dtz(pos, ok) - 1;
+        }
+
+        pos.unmake_move();
+
+        if (!*ok) {
+            return 0;
+        }
+
+        best = std::min(value, best);
+    }
+
+    return best;
+}
+
+int probe_dtz(Position& pos, bool* ok) {
+    int dtz = dtz_without_ep(pos, ok);
+
+    if (!*ok || pos.en_passant_sq == NULL_SQUARE) {
+        return dtz;
+    }
+
+    bool only_ep;
+    int ep_value = wdl_of_ep(pos, ok, &only_ep);
+
+    if (!*ok || ep_value == INT_MIN) {
+        return dtz;
+    }
+
+    int wdl = dtz > 100 ? WDL_CURSED_WIN : dtz > 0 ? WDL_WIN : dtz < -100 ? WDL_BLESSED_LOSS : dtz < 0 ? WDL_LOSS : WDL_DRAW;
+
+    // en passant zeroes too, so it is the quickest way to any result that is at least as good
+    if (only_ep || ep_value > wdl || (ep_value == wdl && wdl > WDL_DRAW)) {
+        return dtz_of_zeroing(ep_value);
+    }
+
+    return dtz;
+}
+
+// true if a position since the last zeroing move has occurred before
+bool has_repeated(const Position& pos) {
+    size_t n = pos.undo_stack.size();
+    size_t reversible = std::min(size_t(std::max(pos.half_move_clock, 0)), n);
+
+    std::vector<uint64_t> keys = { pos.zobrist };
+
+    for (size_t i = 1; i <= reversible; ++i) {
+        keys.push_back(pos.undo_stack[n - i].zobrist);
+    }
+
+    std::sort(keys.begin(), keys.end());
+    return std::adjacent_find(keys.begin(), keys.end()) != keys.end();
+}
+
+// Scores root moves by distance to zeroing. Wins that beat the 50-move rule score
+// equally unless the game has started repeating, then the quickest ones are preferred;
+// wins spoiled by it go for the fewest plies in case the opponent slips, and losses
+// the 50-move rule can save go for the most.
+bool score_root_moves_dtz(Position& pos, const MoveList& moves, int* scores) {
+    bool ok = true;
+    int clock = pos.half_move_clock;
+    bool repeated = has_repeated(pos);
+
+    for (int i = 0; i < moves.count; ++i) {
+        pos.make_move(moves.data[i]);
+
+        int dtz;
+
+        if (pos.half_move_clock == 0) {
+            dtz = dtz_of_zeroing(-probe_wdl(pos, &ok));
+        }
+        else if (is_mate(pos)) {
+            dtz = 1;
+        }
+        else {
+            dtz = -probe_dtz(pos, &ok);
+            dtz += dtz > 0 ? 1 : dtz < 0 ? -1 : 0;
+        }
+
+        pos.unmake_move();
+
+        if (!ok) {
+            return false;
+        }
+
+        if (dtz > 0) {
+            scores[i] = dtz + clock <= 100 ? 1000 - (repeated ? dtz : 0) : 500 - dtz;
+        }
+        else if (dtz < 0) {
+            scores[i] = -dtz + clock <= 100 ? -1000 : -500 - dtz;
+        }
+        else {
+            scores[i] = 0;
+        }
+    }
+
+    return true;
+}
+
+bool score_root_moves_wdl(Position& pos, const MoveList& moves, int* scores) {
+    bool ok = true;
+
+    for (int i = 0; i < moves.count; ++i) {
+        pos.make_move(moves.data[i]);
+        scores[i] = -probe_wdl(pos, &ok);
+        pos.unmake_move();
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+std::vector<std::string> split_paths(const std::string& paths) {
+#ifdef _WIN32
+    const char separator = ';';
+#else
+    const char separator = ':';
+#endif
+
+    std::vector<std::string> result;
+    size_t start = 0;
+
+    while (start <= paths.size()) {
+        size_t end = paths.find(separator, start);
+
+        if (end == std::string::npos) {
+            end = paths.size();
+        }
+
+        if (end > start) {
+            result.push_back(paths.substr(start, end - start));
+        }
+
+        start = end + 1;
+    }
+
+    return result;
+}
+
+int tb_init(const std::string& paths) {
+    tables_by_key.clear();
+    tables.clear();
+    max_pieces = 0;
+
+    tb_paths = split_paths(paths);
+
+    if (tb_paths.empty() || paths == "<empty>") {
+        tb_paths.clear();
+        return 0;
+    }
+
+    init_index_tables();
+
+    std::vector<std::string> sets;
+    piece_sets(sets, "", CODE_KING - 1, TB_MAX_PIECES - 2);
+
+    for (size_t i = 0; i < sets.size(); ++i) {
+        for (size_t j = 0; j <= i; ++j) {
+            size_t count = sets[i].size() + sets[j].size();
+
+            if (count > 0 && count <= TB_MAX_PIECES - 2) {
+                add_material(sets[i], sets[j]);
+            }
+        }
+    }
+
+    return int(tables.size() / 2);
+}
+
+void tb_set_probe_limit(int pieces) {
+    probe_limit = std::clamp(pieces, 0, TB_MAX_PIECES);
+}
+
+int tb_cardinality() {
+    return std::min(max_pieces, probe_limit);
+}
+
+WDLScore tb_probe_wdl(Position& pos, bool* success) {
+    *success = true;
+    return WDLScore(probe_wdl(pos, success));
+}
+
+int tb_probe_dtz(Position& pos, bool* success) {
+    *success = true;
+    return probe_dtz(pos, success);
+}
+
+bool tb_filter_root_moves(Position& pos, MoveList& moves, bool* dtz_ranked) {
+    int scores[256] = {};
+
+    *dtz_ranked = score_root_moves_dtz(pos, moves, scores);
+
+    if (!*dtz_ranked && !score_root_moves_wdl(pos, moves, scores)) {
+        return false;
+    }
+
+    int best = *std::max_element(scores, scores + moves.count);
+
+    for (int i = moves.count - 1; i >= 0; --i) {
+        if (scores[i] != best) {
+            moves.data[i] = moves.data[--moves.count];
+            scores[i] = scores[moves.count];
+        }
+    }
+
+    return true;
+}
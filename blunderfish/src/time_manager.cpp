@@ -0,0 +1,72 @@
+#include "blunderfish.h"
+
+static constexpr double MOVE_OVERHEAD   = 0.03; // seconds kept back for communication with the GUI
+static constexpr int DEFAULT_MOVES_TO_GO = 40;
+
+TimeManager::TimeManager(double seconds, int node_limit)
+    : _node_limit(node_limit), _adaptive(false)
+{
+    _hard = std::max(seconds - MOVE_OVERHEAD, 0.001);
+    _soft = _hard;
+
+    init();
+}
+
+TimeManager::TimeManager(const ClockState& clock, int node_limit)
+    : _node_limit(node_limit), _adaptive(true)
+{
+    double time_left = std::max(double(clock.time_ms) / 1000.0 - MOVE_OVERHEAD, 0.001);
+    double increment = double(clock.increment_ms) / 1000.0;
+
+    int moves_to_go = clock.moves_to_go > 0 ? std::min(clock.moves_to_go, DEFAULT_MOVES_TO_GO) : DEFAULT_MOVES_TO_GO;
+
+    // never plan to spend more than we can afford on this move, the last move before a time control gets almost everything
+    double max_usable = moves_to_go == 1 ? time_left * 0.9 : time_left * 0.5;
+
+    double optimum = time_left / double(moves_to_go) + increment * 0.75;
+
+    _hard = std::min(optimum * 4.0, max_usable);
+    _soft = std::min(optimum * 0.7, _hard);
+
+    init();
+}
+
+void TimeManager::init() {
+    _start = Clock::now();
+    _last_best_move = NULL_MOVE;
+    _stability = 0;
+    _last_score = 0;
+}
+
+double TimeManager::elapsed() const {
+    int64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - _start.load()).count();
+    return double(microseconds)/1000000.0;
+}
+
+bool TimeManager::should_exit(Position& pos) const {
+    return pos.node_count >= _node_limit || elapsed() >= _hard;
+}
+
+bool TimeManager::should_start_iteration(const IterationInfo& last) {
+    if (!_adaptive) {
+        return elapsed() < _hard;
+    }
+
+    // the longer the best move has held, the less time we need
+    _stability = last.best_move == _last_best_move ? std::min(_stability + 1, 8) : 0;
+    double stability_scale = 1.5 - 0.1 * double(_stability);
+
+    // spend more when the score is dropping between iterations
+    double score_drop = last.depth > 1 ? double(_last_score - last.score) : 0.0;
+    double drop_scale = 1.0 + std::clamp(score_drop / 100.0, 0.0, 0.6);
+
+    // a best move that soaks up most of the nodes is unlikely to change
+    double effort_scale = std::clamp(1.6 - last.best_move_effort, 0.6, 1.4);
+
+    _last_best_move = last.best_move;
+    _last_score = last.score;
+
+    double scale = std::clamp(stability_scale * drop_scale * effort_scale, 0.4, 2.5);
+
+    return elapsed() < std::min(_soft * scale, _hard);
+}
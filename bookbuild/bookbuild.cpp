@@ -0,0 +1,457 @@
+#include <random>
+#include <thread>
+#include <mutex>
+#include <map>
+
+#include "blunderfish.h"
+
+// Builds a Polyglot book from PGN files and from games the engine plays against itself.
+// Every move made in the first plies of a game is counted against the Polyglot key of the position it was played
+// from, together with the result for the side that played it and, in self-play, the engine's score. Moves seen in
+// enough games are weighted by how often they were played times how well they did, scaled per position.
+
+constexpr int SELFPLAY_DEPTH = 20;
+
+static const char* START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+struct Options {
+    std::vector<std::string> pgn_paths;
+    std::string out_path = "book.bin";
+    int selfplay_games = 0;
+    int nodes = 10000;
+    int max_plies = 20;
+    int book_plies = 4;       // random plies from the embedded book that open every self-play game
+    int min_games = 2;
+    double score_blend = 0.5; // share of the engine's score in the expected score of self-play moves
+    int threads = int(std::max(std::thread::hardware_concurrency(), 1u));
+};
+
+struct MoveStats {
+    uint32_t games = 0;
+    uint32_t points = 0;     // 2 per win and 1 per draw for the side that played the move
+    uint32_t scored = 0;     // games with an engine score
+    double score_sum = 0.0;  // engine scores as expected scores
+};
+
+// Ordered by key, so the moves of a position are adjacent when writing
+using BookStats = std::map<std::pair<uint64_t, uint16_t>, MoveStats>;
+
+struct PlayedMove {
+    uint64_t key;
+    uint16_t move;
+    int side;
+    std::optional<int64_t> score; // for the side to move
+};
+
+static void add_game(BookStats& stats, const std::vector<PlayedMove>& moves, int result) {
+    for (const PlayedMove& m : moves) {
+        MoveStats& s = stats[{ m.key, m.move }];
+
+        s.games++;
+        s.points += uint32_t((m.side == WHITE ? result : -result) + 1);
+
+        if (m.score) {
+            s.scored++;
+            s.score_sum += 1.0 / (1.0 + std::exp(-double(*m.score) / 400.0));
+        }
+    }
+}
+
+static void merge(BookStats& into, const BookStats& from) {
+    for (const auto& [key, s] : from) {
+        MoveStats& t = into[key];
+        t.games += s.games;
+        t.points += s.points;
+        t.scored += s.scored;
+        t.score_sum += s.score_sum;
+    }
+}
+
+static void record_move(std::vector<PlayedMove>& moves, const Position& pos, Move move, std::optional<int64_t> score) {
+    moves.push_back(PlayedMove {
+        .key = pos.encode_polyglot(),
+        .move = encode_polyglot_move(move),
+        .side = pos.to_move,
+        .score = score
+    });
+}
+
+// PGN
+
+static std::optional<int> parse_result(std::string_view s) {
+    if (s == "1-0") return 1;
+    if (s == "0-1") return -1;
+    if (s == "1/2-1/2") return 0;
+    return std::nullopt;
+}
+
+// Each game starts at an [Event tag at the start of a line
+static std::vector<std::string_view> split_games(std::string_view text) {
+    std::vector<std::string_view> games;
+    size_t start = text.find("[Event ");
+
+    while (start != std::string_view::npos) {
+        size_t next = text.find("\n[Event ", start + 1);
+        size_t end = next == std::string_view::npos ? text.size() : next + 1;
+
+        games.push_back(text.substr(start, end - start));
+        start = next == std::string_view::npos ? next : next + 1;
+    }
+
+    return games;
+}
+
+// Fills moves with the first max_plies moves of the game and returns its result, nullopt for
+// unfinished games and games with moves that can't be read
+static std::optional<int> parse_pgn_game(std::string_view game, int max_plies, std::vector<PlayedMove>& moves) {
+    std::optional<int> result;
+    std::string fen = START_FEN;
+
+    size_t i = 0;
+
+    // tags
+    while (i < game.size()) {
+        while (i < game.size() && isspace((unsigned char)game[i])) {
+            i++;
+        }
+
+        if (i >= game.size() || game[i] != '[') {
+            break;
+        }
+
+        size_t end = game.find('\n', i);
+        std::string_view line = game.substr(i, end == std::string_view::npos ? std::string_view::npos : end - i);
+        i = end == std::string_view::npos ? game.size() : end + 1;
+
+        size_t open = line.find('"');
+        size_t close = line.rfind('"');
+
+        if (open == std::string_view::npos || close <= open) {
+            continue;
+        }
+
+        std::string_view value = line.substr(open + 1, close - open - 1);
+
+        if (line.starts_with("[Result ")) {
+            result = parse_result(value);
+        }
+        else if (line.starts_with("[FEN ")) {
+            fen = std::string(value);
+        }
+    }
+
+    std::optional<Position> start = Position::parse_fen(fen);
+
+    if (!start) {
+        return std::nullopt;
+    }
+
+    Position pos = *start;
+    int ply = 0;
+    int variation_depth = 0;
+
+    // movetext, skipping comments, variations and annotations
+    while (i < game.size() && ply < max_plies) {
+        char c = game[i];
+
+        if (isspace((unsigned char)c)) {
+            i++;
+        }
+        else if (c == '{') {
+            size_t end = game.find('}', i);
+            i = end == std::string_view::npos ? game.size() : end + 1;
+        }
+        else if (c == ';') {
+            size_t end = game.find('\n', i);
+            i = end == std::string_view::npos ? game.size() : end + 1;
+        }
+        else if (c == '(') {
+            variation_depth++;
+            i++;
+        }
+        else if (c == ')') {
+            variation_depth--;
+            i++;
+        }
+        else {
+            size_t end = i;
+            while (end < game.size() && !isspace((unsigned char)game[end]) && !strchr("{}();", game[end])) {
+                end++;
+            }
+
+            std::string_view token = game.substr(i, end - i);
+            i = end;
+
+            if (variation_depth > 0 || token.starts_with('$')) {
+                continue;
+            }
+
+            if (token == "*" || parse_result(token)) {
+                break;
+            }
+
+            // move numbers, "12." or "12..." possibly glued to the move
+            size_t digits = 0;
+            while (digits < token.size() && isdigit((unsigned char)token[digits])) {
+                digits++;
+            }
+
+            if (digits < token.size() && token[digits] == '.') {
+                size_t move_start = token.find_first_not_of('.', digits);
+                token = move_start == std::string_view::npos ? std::string_view() : token.substr(move_start);
+            }
+
+            if (token.empty()) {
+                continue;
+            }
+
+            std::optional<Move> move = pos.parse_san(token);
+
+            if (!move) {
+                return std::nullopt;
+            }
+
+            record_move(moves, pos, *move, std::nullopt);
+            pos.make_move(*move);
+            ply++;
+        }
+    }
+
+    return result;
+}
+
+static bool ingest_pgn(const Options& opts, const std::string& path, BookStats& stats) {
+    MappedFile file;
+
+    if (!file.open(path)) {
+        return false;
+    }
+
+    std::string_view text(reinterpret_cast<const char*>(file.data()), file.size());
+    std::vector<std::string_view> games = split_games(text);
+
+    std::atomic<size_t> next_game = 0;
+    std::atomic<size_t> used = 0;
+    std::mutex stats_mutex;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < opts.threads; ++t) {
+        threads.push_back(std::thread([&]() {
+            BookStats local;
+            std::vector<PlayedMove> moves;
+
+            for (size_t g; (g = next_game.fetch_add(1)) < games.size();) {
+                moves.clear();
+                std::optional<int> result = parse_pgn_game(games[g], opts.max_plies, moves);
+
+                if (result) {
+                    add_game(local, moves, *result);
+                    used++;
+                }
+            }
+
+            std::lock_guard guard(stats_mutex);
+            merge(stats, local);
+        }));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    print("{}: {} of {} games used\n", path, used.load(), games.size());
+    return true;
+}
+
+// Self-play
+
+// A few plies picked uniformly from the embedded book make the games differ, then the engine plays.
+// Only the engine's moves are recorded, so the book learns from its own play rather than copying the embedded one.
+static GameResult play_game(const Options& opts, SearchContext& context, std::mt19937_64& rng, std::vector<PlayedMove>& moves) {
+    Position pos = *Position::parse_fen(START_FEN);
+    int ply = 0;
+
+    for (; ply < opts.book_plies; ++ply) {
+        std::array<PolyglotEntry, MAX_BOOK_MOVES> entries;
+        size_t n = embedded_book().probe(pos.encode_polyglot(), entries);
+
+        PolyglotEntry* end = std::remove_if(entries.begin(), entries.begin() + n, [&](const PolyglotEntry& e) {
+            return !pos.is_move_legal(pos.decode_polyglot(e));
+        });
+
+        if (end == entries.begin()) {
+            break;
+        }
+
+        size_t pick = std::uniform_int_distribution<size_t>(0, size_t(end - entries.begin()) - 1)(rng);
+        pos.make_move(pos.decode_polyglot(entries[pick]));
+    }
+
+    SearchContext* contexts[2] = { &context, &context };
+
+    return play_selfplay_game(pos, contexts, SELFPLAY_DEPTH, {}, [&](Position& searched, Move move, int64_t white_score) {
+        if (ply + int(moves.size()) < opts.max_plies) {
+            record_move(moves, searched, move, searched.to_move == WHITE ? white_score : -white_score);
+        }
+    });
+}
+
+static void run_selfplay(const Options& opts, BookStats& stats) {
+    std::atomic<int> next_game = 0;
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < opts.threads; ++t) {
+        threads.push_back(std::thread([&]() {
+            BookStats local;
+            std::vector<PlayedMove> moves;
+
+            std::atomic<bool> should_stop = false;
+            NodeBudgeter budgeter(opts.nodes);
+            auto context = std::make_unique<SearchContext>(SearchParameters{}, should_stop, &budgeter);
+
+            for (int g; (g = next_game.fetch_add(1)) < opts.selfplay_games;) {
+                std::mt19937_64 rng(g); // seeded by the game, so runs are repeatable
+                moves.clear();
+                GameResult result = play_game(opts, *context, rng, moves);
+                add_game(local, moves, result.result);
+
+                if ((g + 1) % 100 == 0) {
+                    std::lock_guard guard(mutex);
+                    print("Self-play: {}/{} games\n", g + 1, opts.selfplay_games);
+                }
+            }
+
+            std::lock_guard guard(mutex);
+            merge(stats, local);
+        }));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+static std::vector<PolyglotEntry> make_entries(const Options& opts, const BookStats& stats) {
+    std::vector<PolyglotEntry> entries;
+
+    auto it = stats.begin();
+
+    while (it != stats.end()) {
+        uint64_t key = it->first.first;
+        std::vector<std::pair<uint16_t, double>> values; // move and its value
+
+        for (; it != stats.end() && it->first.first == key; ++it) {
+            const MoveStats& s = it->second;
+
+            if (s.games < uint32_t(opts.min_games)) {
+                continue;
+            }
+
+            double expected = double(s.points) / (2.0 * s.games);
+
+            if (s.scored > 0) {
+                expected = (1.0 - opts.score_blend) * expected + opts.score_blend * s.score_sum / s.scored;
+            }
+
+            values.push_back({ it->first.second, s.games * expected });
+        }
+
+        double best = 0.0;
+
+        for (const auto& [move, value] : values) {
+            best = std::max(value, best);
+        }
+
+        // moves that never scored, or round to no weight, are left out rather than kept as a 1 in 65535 pick
+        for (const auto& [move, value] : values) {
+            long weight = best > 0.0 ? std::lround(65535.0 * value / best) : 0;
+
+            if (weight > 0) {
+                entries.push_back(PolyglotEntry { .key = key, .move = move, .weight = uint16_t(weight), .learn = 0 });
+            }
+        }
+    }
+
+    return entries;
+}
+
+static std::optional<Options> parse_options(int argc, const char** argv) {
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--out" && has_value) {
+            opts.out_path = argv[++i];
+        }
+        else if (arg == "--selfplay" && has_value) {
+            opts.selfplay_games = std::max(atoi(argv[++i]), 0);
+        }
+        else if (arg == "--nodes" && has_value) {
+            opts.nodes = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--plies" && has_value) {
+            opts.max_plies = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--book-plies" && has_value) {
+            opts.book_plies = std::max(atoi(argv[++i]), 0);
+        }
+        else if (arg == "--min-games" && has_value) {
+            opts.min_games = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--score-blend" && has_value) {
+            opts.score_blend = std::clamp(atof(argv[++i]), 0.0, 1.0);
+        }
+        else if (arg == "--threads" && has_value) {
+            opts.threads = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg.starts_with("--")) {
+            return std::nullopt;
+        }
+        else {
+            opts.pgn_paths.push_back(arg);
+        }
+    }
+
+    if (opts.pgn_paths.empty() && opts.selfplay_games == 0) {
+        return std::nullopt;
+    }
+
+    return opts;
+}
+
+int main(int argc, const char** argv) {
+    auto parsed = parse_options(argc, argv);
+
+    if (!parsed) {
+        print("Usage: {} [games.pgn]... [--selfplay N] [--nodes N] [--plies N] [--book-plies N] [--min-games N] [--score-blend F] [--threads N] [--out book.bin]\n", argv[0]);
+        return 1;
+    }
+
+    Options opts = *parsed;
+    BookStats stats;
+
+    for (const std::string& path : opts.pgn_paths) {
+        if (!ingest_pgn(opts, path, stats)) {
+            print("Failed to open '{}'\n", path);
+            return 1;
+        }
+    }
+
+    if (opts.selfplay_games > 0) {
+        run_selfplay(opts, stats);
+    }
+
+    std::vector<PolyglotEntry> entries = make_entries(opts, stats);
+
+    if (!write_polyglot_book(opts.out_path, entries)) {
+        print("Failed to write '{}'\n", opts.out_path);
+        return 1;
+    }
+
+    print("Wrote {} moves from {} seen to {}\n", entries.size(), stats.size(), opts.out_path);
+
+    return 0;
+}
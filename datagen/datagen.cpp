@@ -18,82 +18,70 @@ static std::mutex io_mutex;
 
 struct Record {
     std::array<uint64_t, 12> bbs;
-    int32_t score;
+    int16_t score;
     int8_t max_ply;
 };
 
-static GameResult run_match(FILE* file) {
+static GameResult run_match(SearchContext& context, RecordBuffer& buffer) {
     Position pos = *Position::parse_fen(START_FEN);
 
     std::vector<Record> records;
 
-    std::optional<GameResult> gr = std::nullopt;
-
     int n_random = std::uniform_int_distribution<int>(RANDOM_HALF_MOVES, RANDOM_HALF_MOVES+5)(rng);
 
-    for (int hm = 0;;++hm) {
-        gr = pos.game_result();
+    // For the first n moves, play random moves, to diversify the position
+    for (int hm = 0; hm < n_random; ++hm) {
+        std::optional<GameResult> gr = pos.game_result();
 
         if (gr.has_value()) {
-            break;
-        }
-
-        if (hm < n_random) { // For the first n moves, play random moves, to diversify the position
-            MoveList moves = pos.generate_moves();
-            pos.filter_moves(moves);
-
-            size_t move_idx = std::uniform_int_distribution<size_t>(0, moves.count - 1)(rng);
-            Move mv = moves.data[move_idx];
-
-            pos.make_move(mv);
+            return *gr; // too short to be worth recording
         }
-        else { // after that, we let the engine make the move
 
-            std::atomic<bool> should_stop = false;
+        MoveList moves = pos.generate_moves();
+        pos.filter_moves(moves);
 
-            NodeBudgeter budgeter(NODE_BUDGET);
+        size_t move_idx = std::uniform_int_distribution<size_t>(0, moves.count - 1)(rng);
+        Move mv = moves.data[move_idx];
 
-            int64_t score= 0;
-            Move mv= pos.best_move(20, should_stop, &budgeter, {}, false, &score);
+        pos.make_move(mv);
+    }
 
-            if (pos.to_move == BLACK) {
-                score *= -1;
-            }
+    // after that, we let the engine play both sides
+    SearchContext* contexts[2] = { &context, &context };
 
-            bool not_mate = std::abs(score) < (MATE_SCORE - 1000);
-            bool quiet = pos.is_quiescent();
+    GameResult gr = play_selfplay_game(pos, contexts, 20, {}, [&](Position& searched, Move mv, int64_t score) {
+        (void)mv;
 
-            if (quiet && not_mate) {
-                Record r;
-                r.score = int32_t(score);
-                r.bbs = pos.to_bitboards();
-                r.max_ply = int8_t(pos.max_ply);
-                records.push_back(r);
-            }
+        bool not_mate = std::abs(score) < (MATE_SCORE - 1000);
+        bool quiet = searched.is_quiescent();
 
-            pos.make_move(mv);
+        if (quiet && not_mate) {
+            Record r;
+            r.score = int16_t(score);
+            r.bbs = searched.to_bitboards();
+            r.max_ply = int8_t(searched.max_ply);
+            records.push_back(r);
         }
-    }
+    });
 
-    int8_t outcome = int8_t(gr->result);
+    int8_t outcome = int8_t(gr.result);
 
-    {
-        std::lock_guard g(io_mutex);
-        for (Record& r : records) {
-            fwrite(r.bbs.data(), r.bbs.size() * sizeof(uint64_t), 1, file);
-            fwrite(&r.score, sizeof(r.score), 1, file);
-            fwrite(&r.max_ply, sizeof(r.max_ply), 1, file);
-            fwrite(&outcome, sizeof(outcome), 1, file);
-        }
+    for (Record& r : records) {
+        buffer.push(pack_record(r.bbs, r.score, r.max_ply, outcome));
     }
 
-    return *gr;
+    return gr;
 }
 
 int main() {
     for (int iter = 0; iter < NUM_ITERATIONS; ++iter) {
         std::string filename = std::format("data_{:%Y%m%d_%H%M%S}.bin", std::chrono::system_clock::now());
-        FILE* file = fopen(filename.c_str(), "wb");
+        RecordWriter writer;
+
+        if (!writer.open(filename)) {
+            print("Failed to open '{}'\n", filename);
+            return 1;
+        }
 
         std::atomic<int> match_count = 0;
 
@@ -104,7 +92,13 @@ int main() {
         std::atomic<int64_t> result_total = 0;
 
         for (int t = 0; t < nthreads; ++t) {
-            threads.push_back(std::thread([&result_total, &match_count, file, iter](){
+            threads.push_back(std::thread([&result_total, &match_count, &writer, iter](){
+                RecordBuffer buffer(writer);
+
+                std::atomic<bool> should_stop = false;
+                NodeBudgeter budgeter(NODE_BUDGET);
+                auto context = std::make_unique<SearchContext>(SearchParameters{}, should_stop, &budgeter);
+
                 for (;;) {
                     int mid = match_count.fetch_add(1);
 
@@ -112,34 +106,11 @@ int main() {
                         break;
                     }
 
-                    GameResult result = run_match(file);
+                    GameResult result = run_match(*context, buffer);
 
                     auto old_total = result_total.fetch_add(result.result);
 
-                    const char* reason = "";
-
-                    switch (result.reason) {
-                        case GAME_RESULT_CHECKMATE:
-                            if (result.result == 1)  {
-                                reason = "White mates";
-                            }
-                            else{
-                                reason = "Black mates";
-                            }
-                            break;
-
-                        case GAME_RESULT_STALEMATE:
-                            reason = "Stalemate";
-                            break;
-                        
-                        case GAME_RESULT_50_MOVE_RULE:
-                            reason = "50 move rule";
-                            break;
-
-                        case GAME_RESULT_3_FOLD_REPETITION:
-                            reason = "Three-fold repetition";
-                            break;
-                    }
+                    const char* reason = describe_game_result(result);
 
                     {
                         std::lock_guard guard(io_mutex);
@@ -153,10 +124,13 @@ int main() {
             t.join();
         }
 
+        if (!writer.close()) {
+            print("Failed to write '{}'\n", filename);
+            return 1;
+        }
+
         auto x = result_total.load();
         print("Result total: {}\n", x);
-
-        fclose(file);
     }
 
     return 0;
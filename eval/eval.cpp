@@ -1,25 +1,77 @@
 #include "blunderfish.h"
 
-int main(int argc, const char** argv) {
-    if (argc < 2) {
-        print("Usage: {} <fen>\n", argv[0]);
-        return 1;
+constexpr size_t BATCH_SIZE = 1024;
+
+static void flush_batch(std::vector<std::array<uint64_t, 12>>& batch) {
+    std::vector<float> out(batch.size());
+    nnue_infer_batch(batch, out);
+
+    for (float x : out) {
+        print("{}\n", x);
     }
 
-    const char* fen = argv[1];
+    batch.clear();
+}
 
+static bool add_fen(const std::string& fen, std::vector<std::array<uint64_t, 12>>& batch) {
     auto res = Position::parse_fen(fen);
 
     if (!res) {
         print("Invalid fen '{}'\n", fen);
+        return false;
+    }
+
+    batch.push_back(res->to_bitboards());
+
+    if (batch.size() >= BATCH_SIZE) {
+        flush_batch(batch);
+    }
+
+    return true;
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 2) {
+        print("Usage: {} <fen>... | --file <path>\n", argv[0]);
         return 1;
     }
 
-    Position pos = std::move(*res);
+    std::vector<std::array<uint64_t, 12>> batch;
+
+    if (std::string(argv[1]) == "--file") {
+        if (argc < 3) {
+            print("Usage: {} <fen>... | --file <path>\n", argv[0]);
+            return 1;
+        }
+
+        std::ifstream file(argv[2]);
+
+        if (!file) {
+            print("Failed to open '{}'\n", argv[2]);
+            return 1;
+        }
+
+        std::string line;
+
+        while (std::getline(file, line)) {
+            if (line.empty()) {
+                continue;
+            }
+
+            if (!add_fen(line, batch)) {
+                return 1;
+            }
+        }
+    }
+    else {
+        for (int i = 1; i < argc; ++i) {
+            if (!add_fen(argv[i], batch)) {
+                return 1;
+            }
+        }
+    }
 
-    auto bbs = pos.to_bitboards();
-    float x = nnue_infer(bbs);
-    print("{}\n", x);
+    flush_batch(batch);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,586 @@
+#include <random>
+#include <thread>
+#include <mutex>
+#include <sstream>
+#include <memory>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+#include "balanced_openings.h"
+#include "blunderfish.h"
+
+// Plays paired-opening games between two engines and reports Elo and an SPRT verdict as results come in.
+// Each opening is played twice with colours swapped, and statistics are kept per pair (pentanomial), which
+// accounts for the correlation between the two games of a pair.
+
+constexpr int SEARCH_DEPTH = 64;
+
+struct Limits {
+    int nodes = 0;       // per move, used when non-zero
+    double seconds = 0.1; // per move otherwise
+};
+
+struct EngineSpec {
+    std::string uci_path;     // external engine when non-empty
+    std::string params_path;  // parameter file for the built-in engine, empty for the defaults
+};
+
+struct Options {
+    EngineSpec engines[2];
+    Limits limits;
+    int max_games = 20000;
+    int threads = int(std::max(std::thread::hardware_concurrency(), 1u));
+    bool sprt = false;
+    double elo0 = 0.0;
+    double elo1 = 5.0;
+    double alpha = 0.05;
+    double beta = 0.05;
+    std::string openings_path;
+    uint64_t seed = 0;
+};
+
+class Player {
+public:
+    virtual ~Player() = default;
+
+    virtual bool new_game() = 0;
+
+    // picks a move for the position reached by playing moves from the opening, nullopt if the engine failed
+    virtual std::optional<Move> choose(Position& pos, const std::string& opening, const std::vector<Move>& moves) = 0;
+};
+
+class BuiltinPlayer : public Player {
+public:
+    BuiltinPlayer(const SearchParameters& params, const Limits& limits) {
+        if (limits.nodes > 0) {
+            _budgeter = std::make_unique<NodeBudgeter>(limits.nodes);
+        }
+        else {
+            _budgeter = std::make_unique<TimeBudgeter>(limits.seconds);
+        }
+
+        _context = std::make_unique<SearchContext>(params, _should_stop, _budgeter.get());
+    }
+
+    virtual bool new_game() override {
+        _context->clear();
+        return true;
+    }
+
+    virtual std::optional<Move> choose(Position& pos, const std::string& opening, const std::vector<Move>& moves) override {
+        (void)opening;
+        (void)moves;
+
+        _should_stop = false;
+        return pos.best_move(*_context, SEARCH_DEPTH);
+    }
+
+private:
+    std::atomic<bool> _should_stop = false;
+    std::unique_ptr<Budgeter> _budgeter;
+    std::unique_ptr<SearchContext> _context;
+};
+
+#ifndef _WIN32
+class UCIPlayer : public Player {
+public:
+    UCIPlayer(const std::string& path, const Limits& limits)
+        : _limits(limits)
+    {
+        int to_child[2];
+        int from_child[2];
+
+        // close-on-exec, so engines started from other threads don't inherit our pipe ends
+        // and keep them open after we exit or crash
+        if (pipe2(to_child, O_CLOEXEC) != 0 || pipe2(from_child, O_CLOEXEC) != 0) {
+            return;
+        }
+
+        _pid = fork();
+
+        if (_pid == 0) {
+            dup2(to_child[0], STDIN_FILENO); // dup2 clears close-on-exec on the copies
+            dup2(from_child[1], STDOUT_FILENO);
+            execl(path.c_str(), path.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+
+        close(to_child[0]);
+        close(from_child[1]);
+
+        _in = fdopen(to_child[1], "w");
+        _out = fdopen(from_child[0], "r");
+
+        if (_pid < 0 || !_in || !_out) {
+            return;
+        }
+
+        send("uci");
+        _ok = wait_for("uciok").has_value();
+    }
+
+    ~UCIPlayer() {
+        if (_in) {
+            send("quit");
+            fclose(_in);
+        }
+
+        if (_out) {
+            fclose(_out);
+        }
+
+        if (_pid > 0) {
+            waitpid(_pid, nullptr, 0);
+        }
+    }
+
+    bool ok() const {
+        return _ok;
+    }
+
+    virtual bool new_game() override {
+        send("ucinewgame");
+        send("isready");
+        return wait_for("readyok").has_value();
+    }
+
+    virtual std::optional<Move> choose(Position& pos, const std::string& opening, const std::vector<Move>& moves) override {
+        std::string cmd = "position fen " + opening;
+
+        if (!moves.empty()) {
+            cmd += " moves";
+            for (Move mv : moves) {
+                cmd += " " + to_uci_move(mv);
+            }
+        }
+
+        send(cmd);
+
+        if (_limits.nodes > 0) {
+            send(std::format("go nodes {}", _limits.nodes));
+        }
+        else {
+            send(std::format("go movetime {}", int(_limits.seconds * 1000.0)));
+        }
+
+        std::optional<std::string> line = wait_for("bestmove");
+
+        if (!line) {
+            return std::nullopt;
+        }
+
+        std::istringstream iss(*line);
+        std::string token, move;
+        iss >> token >> move;
+
+        // match against the legal moves rather than decoding, so an illegal reply is caught
+        MoveList legal = pos.generate_moves();
+        pos.filter_moves(legal);
+
+        for (Move mv : legal) {
+            if (to_uci_move(mv) == move) {
+                return mv;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    Limits _limits;
+    pid_t _pid = -1;
+    FILE* _in = nullptr;
+    FILE* _out = nullptr;
+    bool _ok = false;
+
+    void send(const std::string& cmd) {
+        fputs((cmd + "\n").c_str(), _in);
+        fflush(_in);
+    }
+
+    std::optional<std::string> wait_for(const std::string& prefix) {
+        char buf[8192];
+
+        while (fgets(buf, sizeof(buf), _out)) {
+            std::string line = buf;
+
+            if (line.starts_with(prefix)) {
+                return line;
+            }
+        }
+
+        return std::nullopt;
+    }
+};
+#endif
+
+static std::unique_ptr<Player> make_player(const EngineSpec& spec, const SearchParameters& params, const Limits& limits) {
+    if (spec.uci_path.empty()) {
+        return std::make_unique<BuiltinPlayer>(params, limits);
+    }
+
+#ifndef _WIN32
+    auto player = std::make_unique<UCIPlayer>(spec.uci_path, limits);
+
+    if (player->ok()) {
+        return player;
+    }
+#endif
+
+    return nullptr;
+}
+
+// Accumulates pair results and derives Elo and the SPRT log-likelihood ratio with a normal approximation
+struct MatchStats {
+    int64_t penta[5] = {}; // pairs by the first engine's score in half points, 0 (lost both) to 4 (won both)
+    int64_t wins = 0;
+    int64_t draws = 0;
+    int64_t losses = 0;
+
+    int64_t pairs() const {
+        return penta[0] + penta[1] + penta[2] + penta[3] + penta[4];
+    }
+
+    // mean and variance of the per-pair score in [0, 1]
+    std::pair<double, double> moments() const {
+        double n = double(pairs());
+        double mean = 0.0;
+        double sq = 0.0;
+
+        for (int i = 0; i < 5; ++i) {
+            double x = double(i) / 4.0;
+            mean += x * double(penta[i]) / n;
+            sq += x * x * double(penta[i]) / n;
+        }
+
+        return { mean, sq - mean * mean };
+    }
+
+    static double score_to_elo(double s) {
+        s = std::clamp(s, 1e-6, 1.0 - 1e-6);
+        return -400.0 * std::log10(1.0 / s - 1.0);
+    }
+
+    static double elo_to_score(double elo) {
+        return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0));
+    }
+
+    // estimate and half-width of the 95% interval
+    std::pair<double, double> elo() const {
+        auto [mean, var] = moments();
+        double margin = 1.959964 * std::sqrt(var / double(pairs()));
+
+        double lo = score_to_elo(mean - margin);
+        double hi = score_to_elo(mean + margin);
+
+        return { score_to_elo(mean), (hi - lo) / 2.0 };
+    }
+
+    double llr(double elo0, double elo1) const {
+        auto [mean, var] = moments();
+
+        if (var <= 0.0) {
+            return 0.0;
+        }
+
+        double s0 = elo_to_score(elo0);
+        double s1 = elo_to_score(elo1);
+        double n = double(pairs());
+
+        return (s1 - s0) * (2.0 * n * mean - n * (s0 + s1)) / (2.0 * var);
+    }
+};
+
+// Returns the game result from white's point of view, nullopt if an engine failed
+static std::optional<int> play_game(const std::string& opening, Player* white, Player* black) {
+    Position pos = *Position::parse_fen(opening);
+    std::vector<Move> moves;
+
+    if (!white->new_game() || !black->new_game()) {
+        return std::nullopt;
+    }
+
+    for (;;) {
+        std::optional<GameResult> result = pos.game_result();
+
+        if (result.has_value()) {
+            return result->result;
+        }
+
+        Player* player = pos.to_move == WHITE ? white : black;
+        std::optional<Move> mv = player->choose(pos, opening, moves);
+
+        if (!mv || *mv == NULL_MOVE) {
+            return std::nullopt;
+        }
+
+        pos.make_move(*mv);
+        moves.push_back(*mv);
+    }
+}
+
+static std::optional<SearchParameters> load_params(const std::string& path) {
+    SearchParameters p;
+
+    if (path.empty()) {
+        return p;
+    }
+
+    std::ifstream file(path);
+
+    if (!file) {
+        return std::nullopt;
+    }
+
+    std::string line;
+
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string name;
+        float value;
+
+        if (!(iss >> name >> value)) {
+            continue;
+        }
+
+        const SearchParameterInfo* info = find_search_parameter(name);
+
+        if (!info) {
+            print("Unknown parameter {} in '{}'\n", name, path);
+            return std::nullopt;
+        }
+
+        info->set(p, value);
+    }
+
+    return p;
+}
+
+// builtin, builtin:<params file> or uci:<engine binary>
+static std::optional<EngineSpec> parse_engine(const std::string& arg) {
+    EngineSpec spec;
+
+    if (arg == "builtin") {
+        return spec;
+    }
+
+    if (arg.starts_with("builtin:")) {
+        spec.params_path = arg.substr(8);
+        return spec;
+    }
+
+    if (arg.starts_with("uci:")) {
+        spec.uci_path = arg.substr(4);
+        return spec;
+    }
+
+    return std::nullopt;
+}
+
+static std::optional<Options> parse_options(int argc, const char** argv) {
+    if (argc < 3) {
+        return std::nullopt;
+    }
+
+    Options opts;
+
+    for (int e = 0; e < 2; ++e) {
+        auto spec = parse_engine(argv[1 + e]);
+
+        if (!spec) {
+            return std::nullopt;
+        }
+
+        opts.engines[e] = *spec;
+    }
+
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--nodes" && has_value) {
+            opts.limits.nodes = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--time" && has_value) {
+            opts.limits.nodes = 0;
+            opts.limits.seconds = atof(argv[++i]);
+        }
+        else if (arg == "--games" && has_value) {
+            opts.max_games = std::max(atoi(argv[++i]), 2);
+        }
+        else if (arg == "--threads" && has_value) {
+            opts.threads = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--sprt" && i + 2 < argc) {
+            opts.sprt = true;
+            opts.elo0 = atof(argv[++i]);
+            opts.elo1 = atof(argv[++i]);
+        }
+        else if (arg == "--alpha" && has_value) {
+            opts.alpha = atof(argv[++i]);
+        }
+        else if (arg == "--beta" && has_value) {
+            opts.beta = atof(argv[++i]);
+        }
+        else if (arg == "--openings" && has_value) {
+            opts.openings_path = argv[++i];
+        }
+        else if (arg == "--seed" && has_value) {
+            opts.seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            return std::nullopt;
+        }
+    }
+
+    return opts;
+}
+
+int main(int argc, const char** argv) {
+    auto parsed = parse_options(argc, argv);
+
+    if (!parsed) {
+        print("Usage: {} <engine> <engine> [--nodes N | --time S] [--games N] [--threads N] [--sprt elo0 elo1] [--alpha A] [--beta B] [--openings file] [--seed N]\n", argv[0]);
+        print("  <engine> is builtin, builtin:<params file> or uci:<path>\n");
+        return 1;
+    }
+
+    Options opts = *parsed;
+
+    SearchParameters params[2];
+
+    for (int e = 0; e < 2; ++e) {
+        auto p = load_params(opts.engines[e].params_path);
+
+        if (!p) {
+            print("Failed to load parameters from '{}'\n", opts.engines[e].params_path);
+            return 1;
+        }
+
+        params[e] = *p;
+    }
+
+    std::vector<std::string> openings;
+
+    if (opts.openings_path.empty()) {
+        openings.assign(std::begin(::openings), std::end(::openings));
+    }
+    else {
+        std::ifstream file(opts.openings_path);
+        std::string line;
+
+        while (std::getline(file, line)) {
+            if (Position::parse_fen(line)) {
+                openings.push_back(line);
+            }
+        }
+
+        if (openings.empty()) {
+            print("No openings in '{}'\n", opts.openings_path);
+            return 1;
+        }
+    }
+
+    std::shuffle(openings.begin(), openings.end(), std::mt19937_64(opts.seed));
+
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN); // a crashed engine shows up as a failed read instead
+#endif
+
+    double lower = std::log(opts.beta / (1.0 - opts.alpha));
+    double upper = std::log((1.0 - opts.beta) / opts.alpha);
+
+    MatchStats stats;
+    std::mutex stats_mutex;
+    std::atomic<int> next_pair = 0;
+    std::atomic<bool> done = false;
+    std::atomic<bool> failed = false;
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < opts.threads; ++t) {
+        threads.push_back(std::thread([&]() {
+            std::unique_ptr<Player> players[2] = {
+                make_player(opts.engines[0], params[0], opts.limits),
+                make_player(opts.engines[1], params[1], opts.limits),
+            };
+
+            if (!players[0] || !players[1]) {
+                failed = true;
+                done = true;
+                return;
+            }
+
+            while (!done) {
+                int pair = next_pair.fetch_add(1);
+
+                if (pair * 2 >= opts.max_games) {
+                    break;
+                }
+
+                const std::string& opening = openings[size_t(pair) % openings.size()];
+
+                std::optional<int> first = play_game(opening, players[0].get(), players[1].get());
+                std::optional<int> second = first ? play_game(opening, players[1].get(), players[0].get()) : std::nullopt;
+
+                if (!second) {
+                    failed = true;
+                    done = true;
+                    break;
+                }
+
+                // half points for the first engine, which had white in the first game
+                int a = *first + 1;
+                int b = 1 - *second;
+
+                std::lock_guard lock(stats_mutex);
+
+                stats.penta[a + b]++;
+
+                for (int r : { a, b }) {
+                    stats.wins += r == 2;
+                    stats.draws += r == 1;
+                    stats.losses += r == 0;
+                }
+
+                auto [elo, margin] = stats.elo();
+                std::string line = std::format("Games {}: +{} -{} ={} | penta [{}, {}, {}, {}, {}] | Elo {:.1f} +/- {:.1f}",
+                    stats.pairs() * 2, stats.wins, stats.losses, stats.draws,
+                    stats.penta[0], stats.penta[1], stats.penta[2], stats.penta[3], stats.penta[4], elo, margin);
+
+                if (opts.sprt) {
+                    double llr = stats.llr(opts.elo0, opts.elo1);
+                    line += std::format(" | LLR {:.2f} ({:.2f}, {:.2f})", llr, lower, upper);
+
+                    if (llr <= lower || llr >= upper) {
+                        done = true;
+                    }
+                }
+
+                print("{}\n", line);
+            }
+        }));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    if (failed) {
+        print("An engine failed to start or returned an illegal move\n");
+        return 1;
+    }
+
+    if (opts.sprt && stats.pairs() > 0) {
+        double llr = stats.llr(opts.elo0, opts.elo1);
+        const char* verdict = llr >= upper ? "H1 accepted" : llr <= lower ? "H0 accepted" : "inconclusive";
+        print("SPRT [{}, {}]: {} (LLR {:.2f})\n", opts.elo0, opts.elo1, verdict, llr);
+    }
+
+    return 0;
+}
@@ -3,72 +3,309 @@
 #include <cstring>
 #include <cmath>
 #include <vector>
-#include <iostream>
+#include <optional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
 
-struct Record {
-    std::vector<int32_t> white_idx, black_idx;
-    float wdl, outcome;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Must match PackedFileHeader / PackedRecord in blunderfish.h
+constexpr uint32_t PACKED_MAGIC = 0x4b504642;
+constexpr uint32_t PACKED_VERSION = 1;
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t RECORD_SIZE = 32;
+
+// Records are shuffled in windows of this many batch-sized blocks, drawn in random order from all files
+constexpr size_t SHUFFLE_WINDOW = 16;
+
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open " + path);
+        }
+
+        struct stat st;
+        fstat(fd, &st);
+        size = size_t(st.st_size);
+
+        void* p = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("failed to map " + path);
+        }
+
+        data = (const uint8_t*)p;
+
+        uint32_t header[4] = {};
+        memcpy(header, data, std::min(size, sizeof(header)));
+
+        if (size < HEADER_SIZE || header[0] != PACKED_MAGIC || header[1] != PACKED_VERSION || header[2] != RECORD_SIZE) {
+            munmap((void*)data, size);
+            throw std::runtime_error(path + " is not a packed record file");
+        }
+
+        madvise((void*)data, size, MADV_RANDOM);
+    }
+
+    ~MappedFile() {
+        munmap((void*)data, size);
+    }
+
+    size_t count() const {
+        return (size - HEADER_SIZE) / RECORD_SIZE;
+    }
+
+    const uint8_t* record(size_t i) const {
+        return data + HEADER_SIZE + i * RECORD_SIZE;
+    }
+};
+
+// A contiguous run of records within one file
+struct Block {
+    uint32_t file;
+    uint64_t first;
+    uint32_t count;
 };
 
-Record parse_one(const uint8_t* ptr) {
-    uint64_t bitboards[12];
-    memcpy(bitboards, ptr, 12 * 8);
-    int32_t score;   memcpy(&score,   ptr + 96, 4);
-    int8_t  outcome; memcpy(&outcome, ptr + 101, 1);
-
-    Record r;
-    for (int side = 0; side < 2; side++) {
-        for (int piece = 0; piece < 6; piece++) {
-            uint64_t bb = bitboards[side*6 + piece];
-            while (bb) {
-                int sq = __builtin_ctzll(bb);
-                bb &= bb - 1;
-                r.white_idx.push_back(side*6*64 + piece*64 + sq);
-                r.black_idx.push_back((1-side)*6*64 + piece*64 + (sq^56));
+using Batch = std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>;
+
+class BatchLoader {
+public:
+    // [first, last) selects records from the concatenation of all files, so one file can be split into train and val
+    BatchLoader(const std::vector<std::string>& paths, int64_t batch_size, int64_t num_threads, bool shuffle, int64_t first, int64_t last, int64_t seed)
+        : _batch_size(batch_size), _num_threads(std::max<int64_t>(num_threads, 1)), _shuffle(shuffle), _rng(seed)
+    {
+        uint64_t offset = 0;
+
+        for (const std::string& path : paths) {
+            _files.push_back(std::make_unique<MappedFile>(path));
+
+            uint64_t begin = std::max<uint64_t>(offset, first);
+            uint64_t end = std::min<uint64_t>(offset + _files.back()->count(), last < 0 ? UINT64_MAX : uint64_t(last));
+
+            for (uint64_t i = begin; i < end; i += batch_size) {
+                uint32_t n = uint32_t(std::min<uint64_t>(batch_size, end - i));
+                _blocks.push_back({ uint32_t(_files.size() - 1), i - offset, n });
+                _num_records += n;
             }
+
+            offset += _files.back()->count();
         }
     }
 
-    r.wdl     = 1.0f / (1.0f + expf(-(float)score / 400.0f));
-    r.outcome = (float)outcome * 0.5f + 0.5f;
-    return r;
-}
+    ~BatchLoader() {
+        stop();
+    }
+
+    int64_t num_records() const {
+        return _num_records;
+    }
+
+    // Depends on how partial blocks fall into windows, so it is exact for the current epoch only
+    int64_t num_batches() const {
+        int64_t n = 0;
 
-// collate whole batch at once - returns pre-concatenated tensors
-std::tuple<torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor, torch::Tensor>
-collate_batch(const std::vector<std::string>& records, float cur_blend) {
-    int B = records.size();
+        for (size_t w = 0; w < _blocks.size(); w += SHUFFLE_WINDOW) {
+            size_t records = 0;
+            for (size_t b = w; b < std::min(w + SHUFFLE_WINDOW, _blocks.size()); ++b) {
+                records += _blocks[b].count;
+            }
+            n += (records + _batch_size - 1) / _batch_size;
+        }
+
+        return n;
+    }
 
-    std::vector<int32_t> all_white, all_black;
-    std::vector<int32_t> white_batch_idx, black_batch_idx;
-    std::vector<float>   targets;
+    // Starts decoding a new pass over the data on the background threads
+    void start_epoch(float blend) {
+        stop();
 
-    for (int i = 0; i < B; i++) {
-        const uint8_t* ptr = (const uint8_t*)records[i].data();
-        Record r = parse_one(ptr);
+        _blend = blend;
+        _stopped = false;
+        _next_window = 0;
+        _active = int(_num_threads);
 
-        for (int32_t idx : r.white_idx) {
-            all_white.push_back(idx);
-            white_batch_idx.push_back(i);
+        if (_shuffle) {
+            std::shuffle(_blocks.begin(), _blocks.end(), _rng);
         }
-        for (int32_t idx : r.black_idx) {
-            all_black.push_back(idx);
-            black_batch_idx.push_back(i);
+
+        for (int64_t t = 0; t < _num_threads; ++t) {
+            _threads.emplace_back([this, seed = _rng()]() { worker(seed); });
         }
+    }
 
-        float target = (1.0f - cur_blend) * r.wdl + cur_blend * r.outcome;
-        targets.push_back(target);
+    std::optional<Batch> next() {
+        std::unique_lock lock(_mutex);
+        _not_empty.wait(lock, [this]() { return !_queue.empty() || _active == 0; });
+
+        if (_queue.empty()) {
+            return std::nullopt;
+        }
+
+        Batch b = std::move(_queue.front());
+        _queue.pop_front();
+        _not_full.notify_one();
+
+        return b;
     }
 
-    return {
-        torch::tensor(all_white,       torch::kInt32),
-        torch::tensor(white_batch_idx, torch::kInt32),
-        torch::tensor(all_black,       torch::kInt32),
-        torch::tensor(black_batch_idx, torch::kInt32),
-        torch::tensor(targets,         torch::kFloat32)
-    };
-}
+private:
+    std::vector<std::unique_ptr<MappedFile>> _files;
+    std::vector<Block> _blocks;
+    int64_t _num_records = 0;
+
+    int64_t _batch_size;
+    int64_t _num_threads;
+    bool _shuffle;
+    std::mt19937_64 _rng;
+
+    float _blend = 0.0f;
+    std::atomic<size_t> _next_window = 0;
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<Batch> _queue;
+    int _active = 0;
+    bool _stopped = false;
+
+    void stop() {
+        {
+            std::lock_guard g(_mutex);
+            _stopped = true;
+        }
+        _not_full.notify_all();
+
+        for (auto& t : _threads) {
+            t.join();
+        }
+
+        _threads.clear();
+        _queue.clear();
+        _active = 0;
+    }
+
+    void worker(uint64_t seed) {
+        std::mt19937_64 rng(seed);
+        std::vector<const uint8_t*> records;
+
+        for (;;) {
+            size_t w = _next_window.fetch_add(SHUFFLE_WINDOW);
+
+            if (w >= _blocks.size()) {
+                break;
+            }
+
+            records.clear();
+
+            for (size_t b = w; b < std::min(w + SHUFFLE_WINDOW, _blocks.size()); ++b) {
+                const Block& block = _blocks[b];
+                for (uint32_t i = 0; i < block.count; ++i) {
+                    records.push_back(_files[block.file]->record(block.first + i));
+                }
+            }
+
+            if (_shuffle) {
+                std::shuffle(records.begin(), records.end(), rng);
+            }
+
+            for (size_t i = 0; i < records.size(); i += _batch_size) {
+                size_t n = std::min<size_t>(_batch_size, records.size() - i);
+                Batch batch = decode(&records[i], n);
+
+                std::unique_lock lock(_mutex);
+                _not_full.wait(lock, [this]() { return _stopped || _queue.size() < size_t(2 * _num_threads); });
+
+                if (_stopped) {
+                    return;
+                }
+
+                _queue.push_back(std::move(batch));
+                _not_empty.notify_one();
+            }
+        }
+
+        std::lock_guard g(_mutex);
+        --_active;
+        _not_empty.notify_all();
+    }
+
+    // Decodes straight into the output tensors, features are laid out record by record
+    Batch decode(const uint8_t* const* records, size_t n) {
+        int64_t num_features = 0;
+
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t occupancy;
+            memcpy(&occupancy, records[i], 8);
+            num_features += std::min(__builtin_popcountll(occupancy), 32);
+        }
+
+        auto opts = torch::TensorOptions().dtype(torch::kInt32).pinned_memory(torch::cuda::is_available());
+
+        torch::Tensor white_features = torch::empty({ num_features }, opts);
+        torch::Tensor white_indices  = torch::empty({ num_features }, opts);
+        torch::Tensor black_features = torch::empty({ num_features }, opts);
+        torch::Tensor black_indices  = torch::empty({ num_features }, opts);
+        torch::Tensor targets        = torch::empty({ int64_t(n) }, opts.dtype(torch::kFloat32));
+
+        int32_t* wf = white_features.data_ptr<int32_t>();
+        int32_t* wi = white_indices.data_ptr<int32_t>();
+        int32_t* bf = black_features.data_ptr<int32_t>();
+        int32_t* bi = black_indices.data_ptr<int32_t>();
+        float* tv = targets.data_ptr<float>();
+
+        for (size_t i = 0; i < n; ++i) {
+            // PackedRecord: occupancy, one piece nibble per occupied square, int16 score, int8 max_ply, int8 outcome
+            const uint8_t* ptr = records[i];
+
+            uint64_t occupancy; memcpy(&occupancy, ptr, 8);
+            const uint8_t* pieces = ptr + 8;
+            int16_t score;   memcpy(&score,   ptr + 24, 2);
+            int8_t  outcome; memcpy(&outcome, ptr + 27, 1);
+
+            for (int k = 0; occupancy && k < 32; occupancy &= occupancy - 1, k++) {
+                int idx = ((pieces[k / 2] >> (4 * (k % 2))) & 0xf) % 12;
+                int side = idx / 6;
+                int piece = idx % 6;
+                int sq = __builtin_ctzll(occupancy);
+
+                *wf++ = side*6*64 + piece*64 + sq;
+                *bf++ = (1-side)*6*64 + piece*64 + (sq^56);
+                *wi++ = int32_t(i);
+                *bi++ = int32_t(i);
+            }
+
+            float wdl = 1.0f / (1.0f + expf(-(float)score / 400.0f));
+            float result = (float)outcome * 0.5f + 0.5f;
+            tv[i] = (1.0f - _blend) * wdl + _blend * result;
+        }
+
+        return { white_features, white_indices, black_features, black_indices, targets };
+    }
+};
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
-    m.def("collate_batch", &collate_batch, "Collate batch of raw NNUE records");
-}
\ No newline at end of file
+    py::class_<BatchLoader>(m, "BatchLoader")
+        .def(py::init<const std::vector<std::string>&, int64_t, int64_t, bool, int64_t, int64_t, int64_t>(),
+            py::arg("paths"), py::arg("batch_size"), py::arg("num_threads") = 8, py::arg("shuffle") = true,
+            py::arg("first") = 0, py::arg("last") = -1, py::arg("seed") = 0)
+        .def("start_epoch", &BatchLoader::start_epoch, py::arg("blend"), py::call_guard<py::gil_scoped_release>())
+        .def("next", &BatchLoader::next, py::call_guard<py::gil_scoped_release>())
+        .def("__len__", &BatchLoader::num_batches)
+        .def_property_readonly("num_records", &BatchLoader::num_records);
+}
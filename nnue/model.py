@@ -1,18 +1,11 @@
-import struct
-import mmap
-import os
 import numpy as np
 
 import torch
 import torch.nn as nn
-from torch.utils.data import Dataset
 import torch.nn.functional as F
 
 torch.set_float32_matmul_precision('high')
 
-RECORD_FORMAT = "=12Qibb"
-RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
-
 def bb_to_squares(bb: int) -> np.ndarray:
     arr = np.array([bb], dtype=np.uint64).view(np.uint8)  # 8 bytes
     bits = np.unpackbits(arr, bitorder='little')           # 64 bits, LSB first
@@ -36,32 +29,6 @@ def bitboards_to_indices(bitboards: list[int], persp:int):
 
     return np.concatenate(indices) if indices else np.array([], dtype=np.int32)
 
-class NNUEDataset(Dataset):
-    def __init__(self, path, start=0, end=None):
-        self.path = path
-        self.mm = None
-        total = os.path.getsize(path) // RECORD_SIZE 
-        self.start = start
-        self.end = end if end is not None else total
-
-    def _ensure_open(self):
-        if self.mm is None:
-            self.f = open(self.path, "rb")
-            self.mm = mmap.mmap(self.f.fileno(), 0, access=mmap.ACCESS_READ)
-
-    def __del__(self):
-        if self.mm is not None:
-            self.mm.close()
-            self.f.close()
-
-    def __len__(self):
-        return self.end - self.start
-
-    def __getitem__(self, idx):
-        self._ensure_open()
-        offset = (idx+self.start) * RECORD_SIZE
-        return bytes(self.mm[offset : offset + RECORD_SIZE])
-
 class NNUE(nn.Module):
     def __init__(self):
         super().__init__()
@@ -1,7 +1,6 @@
 from model import *
 
 import chess
-import struct
 import subprocess
 import math
 import matplotlib.pyplot as plt
@@ -11,9 +10,6 @@ import fens
 
 from scipy.stats import spearmanr
 
-RECORD_FORMAT = "=12Qibb"
-RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
-
 def load_model(path):
     model = NNUE()
     state_dict = torch.load(path, map_location="cpu")
@@ -1,38 +1,26 @@
 from model import *
 
 import time
-import multiprocessing
 
-from torch.utils.data import DataLoader
+from torch.utils.cpp_extension import load
 
 device = torch.device("cuda" if torch.cuda.is_available() else "cpu")
 #device = "cpu"
 
-total = os.path.getsize("aggregate.bin") // RECORD_SIZE
-#total = 200
-split = int(total * 0.9)
-
-train = NNUEDataset("aggregate.bin", 0, split)
-val   = NNUEDataset("aggregate.bin", split, total)
-
-import multiprocessing
-
-torch.multiprocessing.set_sharing_strategy('file_system')
-
-print(f"Training on {len(train)} dataset samples")
-
 batch_size = 16384
 
-from torch.utils.cpp_extension import load
 ext = load(name="data_loader_ext", sources=["data_loader.cpp"], extra_cflags=['-O3'], verbose=True)
 
-CUR_BLEND = multiprocessing.Value('f', 0.5)
+# Produced from the datagen output by the shuffle tool
+train_loader = ext.BatchLoader(["train.bin"], batch_size, num_threads=12, shuffle=True)
+val_loader   = ext.BatchLoader(["val.bin"], batch_size, num_threads=4, shuffle=False)
 
-def collate_fn(batch):
-    return ext.collate_batch(batch, CUR_BLEND.value)
+print(f"Training on {train_loader.num_records} dataset samples")
 
-train_loader = DataLoader(train, batch_size=batch_size, shuffle=False, num_workers=12,persistent_workers=True,collate_fn=collate_fn, pin_memory=True)
-val_loader = DataLoader(val, batch_size=batch_size, num_workers=12,persistent_workers=True,collate_fn=collate_fn)
+def batches(loader, blend):
+    loader.start_epoch(blend)
+    while (batch := loader.next()) is not None:
+        yield batch
 
 model = NNUE()
 model = torch.compile(model)
@@ -64,9 +52,9 @@ def lerp(a, b, t):
 for epoch in range(num_epochs):
     train_loss = 0
 
-    CUR_BLEND.value = lerp(start_blend, end_blend, epoch/(num_epochs-1))
+    blend = lerp(start_blend, end_blend, epoch/(num_epochs-1))
 
-    for i, (white_features, white_indices, black_features, black_indices, target) in enumerate(train_loader):
+    for i, (white_features, white_indices, black_features, black_indices, target) in enumerate(batches(train_loader, blend)):
 
         target = target.to(device)
         white_features = white_features.to(device)
@@ -98,7 +86,7 @@ for epoch in range(num_epochs):
     with torch.no_grad():
         val_loss = 0
 
-        for wf, wi, bf, bi, tv in val_loader:
+        for wf, wi, bf, bi, tv in batches(val_loader, blend):
             tv = tv.to(device)
             wf = wf.to(device)
             wi = wi.to(device)
@@ -109,7 +97,7 @@ for epoch in range(num_epochs):
 
         val_loss /= len(val_loader)
 
-    print(f"Epoch {epoch+1} train: {train_loss:.6f} val: {val_loss:.6f} (wdl blend: {CUR_BLEND.value})")
+    print(f"Epoch {epoch+1} train: {train_loss:.6f} val: {val_loss:.6f} (wdl blend: {blend})")
     model.train()
 
     torch.save(model.state_dict(), f"model_epoch{epoch+1}_val{val_loss:.6f}.pt")
\ No newline at end of file
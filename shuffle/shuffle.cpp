@@ -0,0 +1,343 @@
+#include <random>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "blunderfish.h"
+
+// Merges datagen output into deduplicated, shuffled train and validation files without holding the dataset in memory.
+// Records are scattered into temporary buckets by a hash of their position, so every copy of a position lands in the
+// same bucket and each bucket is a random sample of the whole set. Each bucket is then loaded on its own, deduplicated,
+// shuffled and appended to the outputs, which makes the concatenation a uniform shuffle.
+// When there are more buckets than files we may keep open, the inputs are scattered in several passes.
+
+constexpr size_t READ_CHUNK = 1 << 16;
+constexpr size_t BUCKET_BUFFER = 1 << 16; // write buffer of each open bucket
+constexpr size_t RESERVED_FILES = 16;     // stdio, the input being read and the outputs
+constexpr size_t MAX_PASSES = 64;         // every pass reads all the inputs again
+
+struct Options {
+    std::vector<std::string> inputs;
+    std::string train_path = "train.bin";
+    std::string val_path = "val.bin";
+    std::string tmp_dir = ".";
+    double val_fraction = 0.01;
+    size_t memory_mb = 1024;
+    uint64_t seed = 0;
+};
+
+struct Keyed {
+    uint64_t key;
+    PackedRecord record;
+};
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// Zobrist hash of the piece placement. Side to move and castling rights aren't stored in records
+static uint64_t position_key(const PackedRecord& r) {
+    static const Piece pieces[6] = {
+        PIECE_PAWN,
+        PIECE_KNIGHT,
+        PIECE_BISHOP,
+        PIECE_ROOK,
+        PIECE_QUEEN,
+        PIECE_KING
+    };
+
+    auto bbs = unpack_bitboards(r);
+    uint64_t key = 0;
+
+    for (int i = 0; i < 12; ++i) {
+        for (uint64_t bb = bbs[i]; bb; bb &= bb - 1) {
+            key ^= zobrist_table.piece[i / 6][pieces[i % 6]][std::countr_zero(bb)];
+        }
+    }
+
+    return key;
+}
+
+static std::optional<Options> parse_options(int argc, const char** argv) {
+    Options opts;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--train" && has_value) {
+            opts.train_path = argv[++i];
+        }
+        else if (arg == "--val" && has_value) {
+            opts.val_path = argv[++i];
+        }
+        else if (arg == "--val-fraction" && has_value) {
+            opts.val_fraction = std::clamp(atof(argv[++i]), 0.0, 1.0);
+        }
+        else if (arg == "--memory" && has_value) {
+            opts.memory_mb = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--tmp" && has_value) {
+            opts.tmp_dir = argv[++i];
+        }
+        else if (arg == "--seed" && has_value) {
+            opts.seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg.starts_with("--")) {
+            return std::nullopt;
+        }
+        else {
+            opts.inputs.push_back(arg);
+        }
+    }
+
+    if (opts.inputs.empty()) {
+        return std::nullopt;
+    }
+
+    return opts;
+}
+
+static std::string bucket_path(const Options& opts, size_t i) {
+    return std::format("{}/shuffle_bucket_{}.tmp", opts.tmp_dir, i);
+}
+
+// Removes the bucket files when main returns, whichever way it returns
+struct BucketCleanup {
+    const Options& opts;
+    size_t num_buckets;
+
+    ~BucketCleanup() {
+        for (size_t i = 0; i < num_buckets; ++i) {
+            std::remove(bucket_path(opts, i).c_str());
+        }
+    }
+};
+
+// Bounded by the write buffers fitting in the memory budget and by the open file limit
+static size_t max_open_buckets(const Options& opts) {
+    size_t by_memory = std::max<size_t>(opts.memory_mb * (1 << 20) / BUCKET_BUFFER, 1);
+    size_t open_limit = 512;
+
+#ifdef _WIN32
+    open_limit = size_t(_getmaxstdio());
+#else
+    rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        open_limit = limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : size_t(limit.rlim_cur);
+    }
+#endif
+
+    size_t by_files = open_limit > RESERVED_FILES ? open_limit - RESERVED_FILES : 1;
+    return std::min(by_memory, by_files);
+}
+
+static size_t bucket_of(const PackedRecord& r, const Options& opts, size_t num_buckets) {
+    return size_t(mix(position_key(r) ^ opts.seed) % num_buckets);
+}
+
+// Reads every input and appends the records belonging to buckets [first, last) to their bucket files
+static bool scatter(const Options& opts, size_t num_buckets, size_t first, size_t last, uint64_t* total_in) {
+    std::vector<FILE*> buckets;
+    bool ok = true;
+
+    for (size_t i = first; i < last; ++i) {
+        FILE* f = fopen(bucket_path(opts, i).c_str(), "wb");
+
+        if (!f) {
+            print("Failed to create '{}'\n", bucket_path(opts, i));
+            ok = false;
+            break;
+        }
+
+        setvbuf(f, nullptr, _IOFBF, BUCKET_BUFFER);
+        buckets.push_back(f);
+    }
+
+    std::vector<PackedRecord> chunk(READ_CHUNK);
+
+    for (size_t k = 0; ok && k < opts.inputs.size(); ++k) {
+        FILE* file = fopen(opts.inputs[k].c_str(), "rb");
+
+        if (!file || !read_packed_header(file)) {
+            print("Failed to read '{}'\n", opts.inputs[k]);
+            ok = false;
+
+            if (file) {
+                fclose(file);
+            }
+
+            break;
+        }
+
+        for (;;) {
+            size_t n = fread(chunk.data(), sizeof(PackedRecord), chunk.size(), file);
+
+            if (n == 0 || !ok) {
+                break;
+            }
+
+            for (size_t i = 0; i < n && ok; ++i) {
+                size_t b = bucket_of(chunk[i], opts, num_buckets);
+
+                if (b >= first && b < last && fwrite(&chunk[i], sizeof(PackedRecord), 1, buckets[b - first]) != 1) {
+                    print("Failed to write '{}'\n", bucket_path(opts, b));
+                    ok = false;
+                }
+            }
+
+            if (first == 0) {
+                *total_in += n;
+            }
+        }
+
+        fclose(file);
+    }
+
+    for (FILE* f : buckets) {
+        if (fclose(f) != 0 && ok) {
+            print("Failed to write a bucket in '{}'\n", opts.tmp_dir);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+int main(int argc, const char** argv) {
+    auto parsed = parse_options(argc, argv);
+
+    if (!parsed) {
+        print("Usage: {} <data.bin>... [--train path] [--val path] [--val-fraction F] [--memory MB] [--tmp dir] [--seed N]\n", argv[0]);
+        return 1;
+    }
+
+    Options opts = *parsed;
+
+    uint64_t total_bytes = 0;
+
+    for (const std::string& path : opts.inputs) {
+        FILE* file = fopen(path.c_str(), "rb");
+
+        if (!file || !read_packed_header(file)) {
+            print("'{}' is not a packed record file\n", path);
+            if (file) {
+                fclose(file);
+            }
+            return 1;
+        }
+
+        fseek(file, 0, SEEK_END);
+        total_bytes += uint64_t(ftell(file));
+        fclose(file);
+    }
+
+    // Buckets are sized to half the budget, leaving room for the keys and hash imbalance
+    uint64_t bucket_bytes = opts.memory_mb * (1 << 20) / 2 / sizeof(Keyed) * sizeof(PackedRecord);
+    size_t num_buckets = size_t(total_bytes / bucket_bytes) + 1;
+    size_t per_pass = max_open_buckets(opts);
+    size_t passes = (num_buckets + per_pass - 1) / per_pass;
+
+    if (passes > MAX_PASSES) {
+        print("{} MB needs {} buckets but only {} can be open at once, raise --memory or the open file limit\n",
+            total_bytes >> 20, num_buckets, per_pass);
+        return 1;
+    }
+
+    print("Scattering {} MB into {} buckets in {} pass{}\n", total_bytes >> 20, num_buckets, passes, passes == 1 ? "" : "es");
+
+    BucketCleanup cleanup = { opts, num_buckets };
+    uint64_t total_in = 0;
+
+    for (size_t first = 0; first < num_buckets; first += per_pass) {
+        if (!scatter(opts, num_buckets, first, std::min(first + per_pass, num_buckets), &total_in)) {
+            return 1;
+        }
+    }
+
+    std::vector<PackedRecord> chunk(READ_CHUNK);
+
+    RecordWriter train_writer;
+    RecordWriter val_writer;
+
+    if (!train_writer.open(opts.train_path) || !val_writer.open(opts.val_path)) {
+        print("Failed to open output files\n");
+        return 1;
+    }
+
+    uint64_t total_train = 0;
+    uint64_t total_val = 0;
+
+    {
+        RecordBuffer train(train_writer);
+        RecordBuffer val(val_writer);
+
+        std::mt19937_64 rng(opts.seed);
+        std::vector<Keyed> records;
+
+        uint64_t val_threshold = opts.val_fraction >= 1.0 ? UINT64_MAX : uint64_t(opts.val_fraction * 0x1p64);
+
+        for (size_t i = 0; i < num_buckets; ++i) {
+            std::string path = bucket_path(opts, i);
+            FILE* file = fopen(path.c_str(), "rb");
+
+            if (!file) {
+                print("Failed to reopen '{}'\n", path);
+                return 1;
+            }
+
+            records.clear();
+
+            for (;;) {
+                size_t n = fread(chunk.data(), sizeof(PackedRecord), chunk.size(), file);
+
+                if (n == 0) {
+                    break;
+                }
+
+                for (size_t j = 0; j < n; ++j) {
+                    records.push_back({ position_key(chunk[j]), chunk[j] });
+                }
+            }
+
+            fclose(file);
+            std::remove(path.c_str());
+
+            // Keep the first occurrence of every position
+            std::stable_sort(records.begin(), records.end(), [](const Keyed& a, const Keyed& b) { return a.key < b.key; });
+            auto end = std::unique(records.begin(), records.end(), [](const Keyed& a, const Keyed& b) { return a.key == b.key; });
+            records.erase(end, records.end());
+
+            std::shuffle(records.begin(), records.end(), rng);
+
+            // The split also goes by position, so the same position never ends up on both sides
+            for (const Keyed& k : records) {
+                if (mix(k.key ^ ~opts.seed) < val_threshold) {
+                    val.push(k.record);
+                    total_val++;
+                }
+                else {
+                    train.push(k.record);
+                    total_train++;
+                }
+            }
+        }
+    }
+
+    if (!train_writer.close() || !val_writer.close()) {
+        print("Failed to write output files\n");
+        return 1;
+    }
+
+    uint64_t total_out = total_train + total_val;
+    print("{} records in, {} duplicates removed, {} train, {} val\n", total_in, total_in - total_out, total_train, total_val);
+
+    return 0;
+}
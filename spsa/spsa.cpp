@@ -4,6 +4,9 @@
 #include <thread>
 #include <mutex>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
 
 #include "balanced_openings.h"
 #include "blunderfish.h"
@@ -13,7 +16,8 @@ std::uniform_int_distribution<int> twin_dist(0, 1);
 std::uniform_int_distribution<size_t> opening_dist(0, std::size(openings)-1);
 
 constexpr double time_limit_per_move = 0.1f; 
-constexpr int ngames = 16;
+constexpr int ngames = 16; // openings per perturbation pair, each played with both colours
+constexpr size_t npairs = 8; // perturbation pairs evaluated together in one iteration
 
 struct Param {
     float value;
@@ -27,30 +31,20 @@ float perturb_amount(const Param& param, int iteration) {
 
 // These are continuously updated but rounded to integers in most cases
 struct Params {
-    std::map<std::string, Param> params = {
-        { "lmr_rate_base", { 0.0f, 0.0f, 3.0f }},
-        { "lmr_rate_divisor", { 0.0f, 0.5f, 5.0f }},
-        { "singular_margin_factor", { 0.0f, 0.5f, 5.0f }},
-        { "rfp_margin_factor", { 0.0f, 10.0f, 1000.0f }},
-        { "rfp_improving_bonus", { 0.0f, 0.0f, 1000.0f }},
-        { "fp_margin_factor", { 0.0f, 10.0f, 1000.0f }},
-        { "lmr_history_bonus_threshold", { 0.0f, 100.0f, 5000.0f }},
-        { "history_bonus_factor", { 0.0f, 0.1f, 5.0f }},
-        { "history_malus_factor", { 0.0f, 0.1f, 5.0f }},
-        { "cont_history_bonus_factor", { 0.0f, 0.1f, 5.0f }},
-        { "cont_history_malus_factor", { 0.0f, 0.1f, 5.0f }},
-        { "qsearch_big_delta", { 0.0f, 400.0f, 2000.0f }},
-        { "qsearch_delta_margin", { 0.0f, 50.0f, 1000.0f }},
-        { "asp_initial_window_size", { 0.0f, 10.0f, 100.0f }},
-        { "asp_window_growth_factor", { 0.0f, 1.1f, 100.0f }},
-        { "nmp_r_base", { 0.0f, 1.0f, 6.0f }},
-        { "nmp_r_divisor", { 0.0f, 1.0f, 12.0f }},
-        { "lmp_index_base", { 0.0f, 1.0f, 5.0f }},
-        { "lmp_index_factor", { 0.0f, 0.5f, 5.0f }},
-    };
+    std::map<std::string, Param> params;
+
+    Params() {
+        SearchParameters defaults;
+
+        for (const SearchParameterInfo& info : search_parameter_table()) {
+            params[info.name] = { info.get(defaults), info.lo, info.hi };
+        }
+    }
 
-    void load_from_checkpoint(const char* path) {
+    // Restores the parameters, the RNG and the iteration to resume from. Returns 0 when there is no checkpoint.
+    int load_from_checkpoint(const char* path) {
         std::ifstream file(path);
+        int iteration = 0;
 
         std::string line;
         while(std::getline(file, line)) {
@@ -61,20 +55,51 @@ struct Params {
             std::istringstream iss(line);
 
             std::string attrib;
-            float value;
+            iss >> attrib;
 
-            if (!(iss >> attrib >> value)) {
-                print("Failed to parse checkpoint.\n");
-                exit(1);
+            if (attrib == "iteration") {
+                iss >> iteration;
+            }
+            else if (attrib == "rng") {
+                iss >> rng;
             }
+            else {
+                float value;
+                iss >> value;
 
-            if (!params.contains(attrib)) {
-                print("Unknown attribute {}\n", attrib);
+                if (!params.contains(attrib)) {
+                    print("Unknown attribute {}\n", attrib);
+                    exit(1);
+                }
+
+                params.at(attrib).value = value;
+            }
+
+            if (iss.fail()) {
+                print("Failed to parse checkpoint.\n");
                 exit(1);
             }
+        }
+
+        return iteration;
+    }
 
-            params.at(attrib).value = value;
+    // Written to a temporary file and renamed over the old checkpoint, so an interrupted run never leaves a torn file
+    void save_checkpoint(const char* path, int next_iteration) const {
+        std::string tmp = std::string(path) + ".tmp";
+
+        {
+            std::ofstream f(tmp);
+            f << std::setprecision(9);
+            f << "iteration " << next_iteration << "\n";
+            f << "rng " << rng << "\n";
+
+            for (auto& [name, p] : params) {
+                f << name << " " << p.value << "\n";
+            }
         }
+
+        std::filesystem::rename(tmp, path);
     }
 
     void dump() {
@@ -86,33 +111,13 @@ struct Params {
     }
 
     SearchParameters convert() const {
-        #define match(name) .name = params.at(#name).value
-        #define match_int(name) .name = int(std::round(params.at(#name).value))
-
-        return SearchParameters {
-            match(lmr_rate_base), 
-            match(lmr_rate_divisor), 
-            match(singular_margin_factor), 
-            match_int(rfp_margin_factor), 
-            match_int(rfp_improving_bonus), 
-            match_int(fp_margin_factor), 
-            match_int(lmr_history_bonus_threshold), 
-            match(history_bonus_factor), 
-            match(history_malus_factor), 
-            match(cont_history_bonus_factor), 
-            match(cont_history_malus_factor), 
-            match_int(qsearch_big_delta), 
-            match_int(qsearch_delta_margin), 
-            match_int(asp_initial_window_size), 
-            match(asp_window_growth_factor), 
-            match(nmp_r_base), 
-            match(nmp_r_divisor), 
-            match(lmp_index_base), 
-            match(lmp_index_factor), 
-        };
+        SearchParameters result;
+
+        for (const SearchParameterInfo& info : search_parameter_table()) {
+            info.set(result, params.at(info.name).value);
+        }
 
-        #undef match
-        #undef match_int
+        return result;
     }
 
     void clamp() {
@@ -141,15 +146,24 @@ struct Params {
         };
     }
 
-    void update(const Params& p1, const Params& p2, float ak, float result) {
+    // One step along the gradient estimate averaged over all perturbation pairs of an iteration
+    void update(const std::vector<std::pair<Params, Params>>& twins, const std::vector<float>& results, float ak) {
         for (auto& [name, p] : params)
         {
-            float v1 = (p1.params.at(name).value - p.lo) / (p.hi - p.lo);
-            float v2 = (p2.params.at(name).value - p.lo) / (p.hi - p.lo);
-            float diff = v1 - v2;
+            float step = 0.0f;
+
+            for (size_t k = 0; k < twins.size(); ++k) {
+                float v1 = (twins[k].first.params.at(name).value - p.lo) / (p.hi - p.lo);
+                float v2 = (twins[k].second.params.at(name).value - p.lo) / (p.hi - p.lo);
+                float diff = v1 - v2;
+
+                if (diff != 0.0f) {
+                    step += results[k] / diff;
+                }
+            }
 
             float normalized = (p.value - p.lo) / (p.hi - p.lo);
-            normalized += ak * result / diff;
+            normalized += ak * step / float(twins.size());
             p.value = p.lo + normalized * (p.hi - p.lo);
         }
 
@@ -162,9 +176,12 @@ std::mutex print_mutex;
 static int run_double_sided_game(size_t game_index, const char* opening, const SearchParameters& p1, const SearchParameters& p2) {
     (void)game_index;
 
-    SearchParameters sides[2] = {
-        p1,
-        p2
+    std::atomic<bool> should_stop = false;
+    TimeBudgeter budgeter(time_limit_per_move);
+
+    std::unique_ptr<SearchContext> sides[2] = {
+        std::make_unique<SearchContext>(p1, should_stop, &budgeter),
+        std::make_unique<SearchContext>(p2, should_stop, &budgeter),
     };
 
     int aggregate = 0;
@@ -172,57 +189,21 @@ static int run_double_sided_game(size_t game_index, const char* opening, const S
     for (int round = 0; round < 2; ++round) { // play two rounds, switching sides with the opening
         Position pos = *Position::parse_fen(opening);
 
-        std::optional<GameResult> result = std::nullopt;
-
-        for (;;) {
-            result = pos.game_result();
-
-            if (result.has_value()) { // game over
-                break;
-            }
-
-            TimeBudgeter budgeter(time_limit_per_move);
-
-            std::atomic<bool> should_stop = false;
-            Move move = pos.best_move(20, should_stop, &budgeter, sides[pos.to_move]);
-            pos.make_move(move);
-        }
-
-        const char* reason = "";
+        SearchContext* contexts[2] = { sides[0].get(), sides[1].get() };
+        GameResult result = play_selfplay_game(pos, contexts, 20);
 
-        switch (result->reason) {
-            case GAME_RESULT_CHECKMATE:
-                if (result->result == 1)  {
-                    reason = "White mates";
-                }
-                else{
-                    reason = "Black mates";
-                }
-                break;
-
-            case GAME_RESULT_STALEMATE:
-                reason = "Stalemate";
-                break;
-            
-            case GAME_RESULT_50_MOVE_RULE:
-                reason = "50 move rule";
-                break;
-
-            case GAME_RESULT_3_FOLD_REPETITION:
-                reason = "Three-fold repetition";
-                break;
-        }
+        const char* reason = describe_game_result(result);
 
         {
             std::lock_guard<std::mutex> lock(print_mutex);
-            print("Game {} round {}: {} ({})\n", game_index, round+1, result->result, reason);
+            print("Game {} round {}: {} ({})\n", game_index, round+1, result.result, reason);
         }
 
         if (round == 0) {
-            aggregate += result->result;
+            aggregate += result.result;
         }
         else {
-            aggregate -= result->result;
+            aggregate -= result.result;
         }
 
         std::swap(sides[0], sides[1]);
@@ -231,52 +212,86 @@ static int run_double_sided_game(size_t game_index, const char* opening, const S
     return aggregate;
 }
 
-int main() {
-    Params params{};
-    params.load_from_checkpoint("params_checkpoint.txt");
+struct Game {
+    size_t pair;
+    const char* opening;
+};
 
-    std::vector<Params> history{params};
+static void append_trend(const char* path, const Params& params) {
+    bool exists = std::filesystem::exists(path);
+    std::ofstream f(path, std::ios::app);
 
-    int nthreads = std::max((unsigned int)1, std::thread::hardware_concurrency());
-    print("Running with {} threads.\n", nthreads);
+    int i = 0;
 
-    for (int iteration = 0; iteration < 1000; ++iteration) {
-        
-        std::vector<const char*> games;
+    if (!exists) {
+        for (auto& [name, _p] : params.params) {
+            if (i++ > 0) {
+                f << ", ";
+            }
 
-        for (int i = 0; i < ngames; ++i) {
-            const char* opening = openings[opening_dist(rng)];
-            games.push_back(opening);
+            f << name;
         }
 
+        f << "\n";
+    }
+
+    i = 0;
+
+    for (auto& [name, p] : params.params) {
+        if (i++ > 0) {
+            f << ", ";
+        }
+
+        f << p.value;
+    }
+
+    f << "\n";
+}
+
+int main() {
+    Params params{};
+    int start_iteration = params.load_from_checkpoint("params_checkpoint.txt");
+
+    int nthreads = std::max((unsigned int)1, std::thread::hardware_concurrency());
+    print("Running with {} threads from iteration {}.\n", nthreads, start_iteration);
+
+    for (int iteration = start_iteration; iteration < 1000; ++iteration) {
         float ak = 0.005f / std::pow(float(iteration + 10), 0.3f);
 
-        auto [p1, p2] = params.perturb(iteration);
+        std::vector<std::pair<Params, Params>> twins;
+        std::vector<std::pair<SearchParameters, SearchParameters>> search_params;
+        std::vector<Game> games;
+
+        for (size_t k = 0; k < npairs; ++k) {
+            twins.push_back(params.perturb(iteration));
+            search_params.push_back({ twins[k].first.convert(), twins[k].second.convert() });
+
+            for (int i = 0; i < ngames; ++i) {
+                games.push_back({ k, openings[opening_dist(rng)] });
+            }
+        }
 
-        auto sp1 = p1.convert();
-        auto sp2 = p2.convert();
+        // every thread pulls the next unplayed game, whichever pair it belongs to, so no core idles until the queue is empty
+        std::vector<std::atomic<int>> pair_results(npairs);
+        std::atomic<size_t> game_index{0};
 
         std::vector<std::thread> threads;
         threads.reserve(nthreads);
 
-        std::atomic<size_t> opening_index{0};
-        std::vector<int> thread_results(nthreads, 0);
-
         for (int t = 0; t < nthreads; ++t) {
-            threads.emplace_back([&, t](){
-                int local_sum = 0;
-
+            threads.emplace_back([&](){
                 while (true) {
-                    size_t i = opening_index.fetch_add(1);
+                    size_t i = game_index.fetch_add(1);
 
                     if (i >= games.size()) {
                         break;
                     }
 
-                    local_sum += run_double_sided_game(i, games[i], sp1, sp2);
-                }
+                    const Game& game = games[i];
+                    auto& [sp1, sp2] = search_params[game.pair];
 
-                thread_results[t] = local_sum;
+                    pair_results[game.pair] += run_double_sided_game(i, game.opening, sp1, sp2);
+                }
             });
         }
 
@@ -284,58 +299,21 @@ int main() {
             t.join();
         }
 
-        int result_aggregate = 0;
+        std::vector<float> results;
+        float avg_result = 0.0f;
 
-        for (auto x : thread_results) {
-            result_aggregate += x;
+        for (auto& r : pair_results) {
+            results.push_back(float(r.load()) / float(ngames*2));
+            avg_result += results.back() / float(npairs);
         }
 
-        float avg_result = float(result_aggregate) / float(games.size()*2);
-
-        params.update(p1, p2, ak, avg_result);
+        params.update(twins, results, ak);
 
         print("Iteration: {}\n  ak: {:.4f}\n  result: {}\n", iteration, ak, avg_result);
 
         params.dump();
-        history.push_back(params);
-
-        if (iteration % 10 == 0) {
-            {
-                std::ofstream f("params_checkpoint.txt");
-                for (auto& [name, p] : params.params)
-                    f << name << " " << p.value << "\n";
-            }
-
-            {
-                std::vector<std::string> cols;
-
-                std::ofstream f("trend.csv");
-                int i = 0;
-
-                for (auto& [name, _p] : params.params) {
-                    if (i++ > 0) {
-                        f << ", ";
-                    }
-
-                    f << name;
-                    cols.push_back(name);
-                }
-
-                f << "\n";
-
-                for (auto& entry : history) {
-                    i = 0;
-                    for (auto& name : cols) {
-                        auto& p = entry.params.at(name);
 
-                        if (i++ > 0) {
-                            f << ", ";
-                        }
-                        f << p.value;
-                    }
-                    f << "\n";
-                }
-            }
-        }
+        params.save_checkpoint("params_checkpoint.txt", iteration + 1);
+        append_trend("trend.csv", params);
     }
-}
\ No newline at end of file
+}
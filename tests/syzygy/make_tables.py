@@ -0,0 +1,358 @@
+import argparse
+import hashlib
+import heapq
+import struct
+from collections import deque
+
+# Writes KRvK and KQvK Syzygy tables for the probing tests. Values come from a
+# retrograde analysis, the files use the Syzygy layout: three-unique-piece index
+# encoding, canonical Huffman codes over plain values (no symbol pairs), blocks
+# with a sparse index. The official tables of the same name are drop-in replacements.
+
+parser = argparse.ArgumentParser(description="Generate small Syzygy tables for the tests")
+parser.add_argument("out_dir", help="Directory to write the .rtbw/.rtbz files to")
+args = parser.parse_args()
+
+WDL_MAGIC = bytes([0x71, 0xE8, 0x23, 0x5D])
+DTZ_MAGIC = bytes([0xD7, 0x66, 0x0C, 0xA5])
+
+TB_ROOK = 4
+TB_QUEEN = 5
+TB_KING = 6
+TB_BLACK = 8
+
+BLOCK_BITS = 8  # 256 byte blocks
+SPAN_BITS = 8   # a sparse index entry every 256 values
+
+def file_of(sq): return sq & 7
+def rank_of(sq): return sq >> 3
+
+def king_steps(sq):
+    out = []
+    for df in (-1, 0, 1):
+        for dr in (-1, 0, 1):
+            if df == 0 and dr == 0:
+                continue
+            f, r = file_of(sq) + df, rank_of(sq) + dr
+            if 0 <= f < 8 and 0 <= r < 8:
+                out.append(r * 8 + f)
+    return out
+
+KING_STEPS = [king_steps(sq) for sq in range(64)]
+
+def adjacent(a, b):
+    return max(abs(file_of(a) - file_of(b)), abs(rank_of(a) - rank_of(b))) <= 1
+
+def slides(sq, piece, blockers):
+    dirs = [(1, 0), (-1, 0), (0, 1), (0, -1)]
+    if piece == TB_QUEEN:
+        dirs += [(1, 1), (1, -1), (-1, 1), (-1, -1)]
+
+    out = []
+    for df, dr in dirs:
+        f, r = file_of(sq) + df, rank_of(sq) + dr
+        while 0 <= f < 8 and 0 <= r < 8:
+            to = r * 8 + f
+            out.append(to)
+            if to in blockers:
+                break
+            f, r = f + df, r + dr
+    return out
+
+def attacked_by_piece(piece, x, target, wk):
+    return target in slides(x, piece, (wk,))
+
+# Positions are (wk, x, bk) with x the white rook or queen
+
+def legal_placement(wk, x, bk):
+    return wk != x and wk != bk and x != bk and not adjacent(wk, bk)
+
+def black_moves(piece, wk, x, bk):
+    """Black king moves: (squares reached without capturing, whether the piece can be taken)"""
+    quiet = []
+    can_capture = False
+    for to in KING_STEPS[bk]:
+        if adjacent(to, wk):
+            continue
+        if to == x:
+            can_capture = True
+            continue
+        if to in slides(x, piece, (wk,)):
+            continue
+        quiet.append(to)
+    return quiet, can_capture
+
+def white_moves(piece, wk, x, bk):
+    out = []
+    for to in KING_STEPS[wk]:
+        if to != x and not adjacent(to, bk):
+            out.append((to, x))
+    for to in slides(x, piece, (wk, bk)):
+        if to != wk and to != bk:
+            out.append((wk, to))
+    return out
+
+def solve(piece):
+    """Distance to mate in plies for white wins (white to move) and black losses (black to move)"""
+    white = {}  # (wk, x, bk) -> plies to mate
+    black = {}
+    remaining = {}
+    queue = deque()
+
+    for wk in range(64):
+        for x in range(64):
+            for bk in range(64):
+                if not legal_placement(wk, x, bk):
+                    continue
+                quiet, can_capture = black_moves(piece, wk, x, bk)
+                if can_capture:
+                    continue
+                remaining[(wk, x, bk)] = len(quiet)
+                if not quiet and attacked_by_piece(piece, x, bk, wk):
+                    black[(wk, x, bk)] = 0
+                    queue.append((1, (wk, x, bk)))
+
+    # moves are reversible, so the predecessors of a position are its successors
+    # with the other side to move
+    while queue:
+        side, pos = queue.popleft()
+        wk, x, bk = pos
+
+        if side == 1:
+            d = black[pos] + 1
+            for prev in white_moves(piece, wk, x, bk):
+                prev = (prev[0], prev[1], bk)
+                if prev not in white and not attacked_by_piece(piece, prev[1], bk, prev[0]):
+                    white[prev] = d
+                    queue.append((0, prev))
+        else:
+            d = white[pos] + 1
+            if attacked_by_piece(piece, x, bk, wk):
+                continue
+            for from_sq in KING_STEPS[bk]:
+                prev = (wk, x, from_sq)
+                if prev in remaining and prev not in black:
+                    remaining[prev] -= 1
+                    if remaining[prev] == 0:
+                        black[prev] = d
+                        queue.append((1, prev))
+
+    return white, black
+
+# Index encoding for tables whose first three pieces are unique
+
+def below_diagonal_squares():
+    return [sq for sq in range(64) if file_of(sq) > rank_of(sq)]
+
+LOWER = {sq: i for i, sq in enumerate(below_diagonal_squares())}
+TRIANGLE = {sq: i for i, sq in enumerate([1, 2, 3, 10, 11, 19])}  # b1 c1 d1 c2 d2 d3
+
+def transpose(sq):
+    return file_of(sq) * 8 + rank_of(sq)
+
+def encode(squares):
+    p = list(squares)
+
+    if file_of(p[0]) >= 4:
+        p = [sq ^ 7 for sq in p]
+    if rank_of(p[0]) >= 4:
+        p = [sq ^ 56 for sq in p]
+
+    for sq in p[:3]:
+        if rank_of(sq) != file_of(sq):
+            if rank_of(sq) > file_of(sq):
+                p = [transpose(s) for s in p]
+            break
+
+    a, b, c = p
+    i = int(b > a)
+    j = int(c > a) + int(c > b)
+    on_diagonal = lambda sq: rank_of(sq) == file_of(sq)
+
+    if not on_diagonal(a):
+        return TRIANGLE[a] * 63 * 62 + (b - i) * 62 + (c - j)
+    if not on_diagonal(b):
+        return 6 * 63 * 62 + rank_of(a) * 28 * 62 + LOWER[b] * 62 + (c - j)
+    if not on_diagonal(c):
+        return 6 * 63 * 62 + 4 * 28 * 62 + rank_of(a) * 7 * 28 + (rank_of(b) - i) * 28 + LOWER[c]
+    return 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + rank_of(a) * 7 * 6 + (rank_of(b) - i) * 6 + (rank_of(c) - j)
+
+TABLE_SIZE = 31332
+
+# Compression
+
+def huffman_lengths(freq):
+    if len(freq) == 1:
+        return {next(iter(freq)): 1}
+
+    heap = [(f, i, [v]) for i, (v, f) in enumerate(sorted(freq.items()))]
+    heapq.heapify(heap)
+    lengths = {v: 0 for v in freq}
+    tie = len(heap)
+
+    while len(heap) > 1:
+        f1, _, s1 = heapq.heappop(heap)
+        f2, _, s2 = heapq.heappop(heap)
+        for v in s1 + s2:
+            lengths[v] += 1
+        heapq.heappush(heap, (f1 + f2, tie, s1 + s2))
+        tie += 1
+
+    return lengths
+
+def compress(values, flags):
+    """Returns (header, sparse index, block sizes, data) for one sub-table"""
+    freq = {}
+    for v in values:
+        freq[v] = freq.get(v, 0) + 1
+
+    if len(freq) == 1:
+        return bytes([flags | 0x80, values[0]]), b"", b"", b""
+
+    lengths = huffman_lengths(freq)
+    min_len = min(lengths.values())
+    max_len = max(lengths.values())
+
+    # symbols are numbered from the longest codes down, each one a plain value
+    symbols = sorted(freq, key=lambda v: (-lengths[v], v))
+    count = [0] * (max_len + 2)
+    for v in symbols:
+        count[lengths[v]] += 1
+
+    first_sym = [0] * (max_len + 2)  # first symbol with a code of this length
+    for l in range(max_len - 1, min_len - 1, -1):
+        first_sym[l] = first_sym[l + 1] + count[l + 1]
+
+    first_code = [0] * (max_len + 2)
+    for l in range(max_len - 1, min_len - 1, -1):
+        assert (first_code[l + 1] + count[l + 1]) % 2 == 0
+        first_code[l] = (first_code[l + 1] + count[l + 1]) // 2
+
+    code_of = {}
+    for sym, v in enumerate(symbols):
+        l = lengths[v]
+        code_of[v] = (first_code[l] + sym - first_sym[l], l)
+
+    # pack values into blocks, a value never straddles two blocks
+    block_bits = (1 << BLOCK_BITS) * 8
+    blocks = []
+    block_first = []
+    bits = []
+    used = 0
+    for idx, v in enumerate(values):
+        code, l = code_of[v]
+        if used + l > block_bits or not block_first:
+            if block_first:
+                blocks.append(bits)
+            block_first.append(idx)
+            bits = []
+            used = 0
+        bits.append((code, l))
+        used += l
+    blocks.append(bits)
+
+    data = bytearray()
+    sizes = bytearray()
+    for block in blocks:
+        acc = 0
+        n = 0
+        for code, l in block:
+            acc = (acc << l) | code
+            n += l
+        acc <<= block_bits - n
+        data += acc.to_bytes(1 << BLOCK_BITS, "big")
+        sizes += struct.pack("<H", len(block) - 1)
+
+    span = 1 << SPAN_BITS
+    sparse = bytearray()
+    for k in range((len(values) + span - 1) // span):
+        mid = k * span + span // 2
+        b = len(blocks) - 1
+        while b > 0 and block_first[b] > mid:
+            b -= 1
+        sparse += struct.pack("<IH", b, mid - block_first[b])
+
+    header = bytearray([flags, BLOCK_BITS, SPAN_BITS, 0])
+    header += struct.pack("<I", len(blocks))
+    header += bytes([max_len, min_len])
+    for l in range(min_len, max_len + 1):
+        header += struct.pack("<H", first_sym[l])
+    header += struct.pack("<H", len(symbols))
+    for v in symbols:
+        header += bytes([v & 0xFF, (v >> 8) | 0xF0, 0xFF])  # a leaf: left is the value, right is 0xFFF
+    if len(symbols) & 1:
+        header += b"\0"
+
+    return bytes(header), bytes(sparse), bytes(sizes), bytes(data)
+
+def write_table(path, magic, file_flags, pieces, parts):
+    out = bytearray(magic)
+    out.append(file_flags)
+    out.append(0)  # the three unique pieces lead for both sides
+    out += bytes((p | (p << 4)) for p in pieces)
+    if len(out) & 1:
+        out.append(0)
+
+    for header, _, _, _ in parts:
+        out += header
+    for _, sparse, _, _ in parts:
+        out += sparse
+    for _, _, sizes, _ in parts:
+        out += sizes
+    for _, _, _, data in parts:
+        out += bytes(-len(out) % 64)
+        out += data
+
+    out += hashlib.md5(out).digest()
+    assert len(out) % 64 == 16
+
+    with open(path, "wb") as f:
+        f.write(out)
+
+def make_tables(piece, name):
+    white, black = solve(piece)
+    pieces = [TB_KING, piece, TB_KING | TB_BLACK]
+
+    wdl = [[2] * TABLE_SIZE, [2] * TABLE_SIZE]  # by side to move, WDL + 2
+    dtz = [0] * TABLE_SIZE                       # white to move, plies - 1
+
+    def store(table, idx, value):
+        assert table[idx] in (value, None), "symmetric positions disagree"
+        table[idx] = value
+
+    seen = [[None] * TABLE_SIZE, [None] * TABLE_SIZE, [None] * TABLE_SIZE]
+
+    for wk in range(64):
+        for x in range(64):
+            for bk in range(64):
+                if not legal_placement(wk, x, bk):
+                    continue
+                idx = encode((wk, x, bk))
+                pos = (wk, x, bk)
+
+                if not attacked_by_piece(piece, x, bk, wk):
+                    won = pos in white
+                    store(seen[0], idx, 4 if won else 2)
+                    store(seen[2], idx, white[pos] - 1 if won else 0)
+
+                store(seen[1], idx, 0 if pos in black else 2)
+
+    for side in range(2):
+        for idx, v in enumerate(seen[side]):
+            if v is not None:
+                wdl[side][idx] = v
+    for idx, v in enumerate(seen[2]):
+        if v is not None:
+            dtz[idx] = v
+
+    write_table(f"{args.out_dir}/{name}.rtbw", WDL_MAGIC, 0x01, pieces,
+                [compress(wdl[0], 0), compress(wdl[1], 0)])
+
+    # white to move only, both wins and losses counted in plies
+    write_table(f"{args.out_dir}/{name}.rtbz", DTZ_MAGIC, 0x00, pieces,
+                [compress(dtz, 0x04 | 0x08)])
+
+    print(f"{name}: {len(white)} wins with white to move, longest {max(white.values())} plies")
+
+make_tables(TB_ROOK, "KRvK")
+make_tables(TB_QUEEN, "KQvK")
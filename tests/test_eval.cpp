@@ -4,7 +4,7 @@
 static void check_eval(Position& position) {
     int64_t new_eval = position.compute_eval();
 
-    REQUIRE(std::abs(new_eval - position.incr_eval) <= 2);
+    REQUIRE(std::abs(new_eval - position.white_eval()) <= 2);
 }
 
 void eval_search(int depth, Position& position) {
@@ -50,4 +50,35 @@ TEST_CASE("Eval - increment_eval equals eval | STARTING POSITION") {
 TEST_CASE("Eval - increment_eval equals eval | KIWIPETE_POSITION") {
     Position pos = *Position::parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
     eval_search(3, pos);
-}
\ No newline at end of file
+}
+
+static void collect_positions(int depth, Position& position, std::vector<std::array<uint64_t, 12>>& out) {
+    out.push_back(position.to_bitboards());
+
+    if (depth == 0) {
+        return;
+    }
+
+    MoveList moves = position.generate_moves();
+    position.filter_moves(moves);
+
+    for (Move move : moves) {
+        position.make_move(move);
+        collect_positions(depth-1, position, out);
+        position.unmake_move();
+    }
+}
+
+TEST_CASE("Eval - nnue_infer_batch equals nnue_infer") {
+    Position pos = *Position::parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+
+    std::vector<std::array<uint64_t, 12>> positions;
+    collect_positions(2, pos, positions);
+
+    std::vector<float> batch(positions.size());
+    nnue_infer_batch(positions, batch);
+
+    for (size_t i = 0; i < positions.size(); ++i) {
+        REQUIRE(batch[i] == nnue_infer(positions[i]));
+    }
+}
@@ -84,3 +84,222 @@ TEST_CASE("Pin-mask is correct") {
     test_pin_case("k1b3bR/1p6/1q3r2/5b2/3BBP2/4Pr2/5K2/8 w - - 0 1", {}, {49});
     test_pin_case("k1b3bR/1p6/1q3r2/r4b2/3BBP2/4Pr2/5K2/R7 w - - 0 1", {}, {49, 32});
 }
+
+// every generated move must pass is_move_legal, and moves collected from other positions must pass exactly when movegen agrees
+static void test_move_legality(Position& pos, int depth, std::vector<Move>& foreign_moves) {
+    MoveList moves = pos.generate_moves();
+    pos.filter_moves(moves);
+
+    std::unordered_set<Move> legal_set;
+
+    for (Move mv : moves) {
+        legal_set.insert(mv);
+        REQUIRE(pos.is_move_pseudo_legal(mv));
+        REQUIRE(pos.is_move_legal(mv));
+    }
+
+    for (Move mv : foreign_moves) {
+        REQUIRE(pos.is_move_legal(mv) == (legal_set.count(mv) > 0));
+    }
+
+    size_t foreign_count = foreign_moves.size();
+    foreign_moves.insert(foreign_moves.end(), moves.data, moves.data + moves.count);
+
+    if (depth > 0) {
+        for (Move mv : moves) {
+            pos.make_move(mv);
+            test_move_legality(pos, depth-1, foreign_moves);
+            pos.unmake_move();
+        }
+    }
+
+    foreign_moves.resize(foreign_count);
+}
+
+TEST_CASE("Move legality check agrees with move generation") {
+    const char* fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    };
+
+    for (const char* fen : fens) {
+        auto pos = *Position::parse_fen(fen);
+        std::vector<Move> foreign_moves;
+        test_move_legality(pos, 2, foreign_moves);
+    }
+}
+
+// gives_check must agree with making the move, and the checkers with is_checked
+static void test_gives_check(Position& pos, int depth) {
+    CheckInfo ci = pos.check_info();
+    REQUIRE((ci.checkers != 0) == pos.is_checked[pos.to_move]);
+    REQUIRE(ci.pinned == pos.generate_pin_mask(pos.to_move));
+
+    int side = pos.to_move;
+    MoveList moves = pos.generate_moves(ci.pinned);
+
+    for (Move mv : moves) {
+        bool checking = pos.gives_check(mv, ci);
+
+        pos.make_move(mv);
+
+        if (!pos.is_checked[side]) {
+            REQUIRE(checking == pos.is_checked[opponent(side)]);
+
+            if (depth > 0) {
+                test_gives_check(pos, depth-1);
+            }
+        }
+
+        pos.unmake_move();
+    }
+}
+
+TEST_CASE("Gives-check agrees with making the move") {
+    const char* fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "4k3/8/8/2KPp2r/8/8/8/8 w - e6 0 2",
+        "3k4/1P6/8/8/8/8/8/R3K2R w KQ - 0 1",
+    };
+
+    for (const char* fen : fens) {
+        auto pos = *Position::parse_fen(fen);
+        test_gives_check(pos, 3);
+    }
+}
+
+// see_ge must answer exactly like the full swap list of see()
+static void test_see_ge(Position& pos, int depth) {
+    static const int thresholds[] = { -900, -400, -200, -100, -1, 0, 1, 100, 200, 201, 400, 500, 900 };
+
+    MoveList moves = pos.generate_moves();
+    pos.filter_moves(moves);
+
+    for (Move mv : moves) {
+        int value = pos.see(mv);
+
+        for (int t : thresholds) {
+            REQUIRE(pos.see_ge(mv, t) == (value >= t));
+        }
+
+        if (depth > 0) {
+            pos.make_move(mv);
+            test_see_ge(pos, depth-1);
+            pos.unmake_move();
+        }
+    }
+}
+
+TEST_CASE("Threshold SEE agrees with SEE") {
+    const char* fens[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - 0 1",
+        "2r2r1k/6bp/p7/2q2p1Q/3PpP2/1B6/P5PP/2RR3K b - - 0 1",
+        "4R3/2r3p1/5bk1/1p1r3p/p2PR1P1/P1BK1P2/1P6/8 b - - 0 1",
+    };
+
+    for (const char* fen : fens) {
+        auto pos = *Position::parse_fen(fen);
+        test_see_ge(pos, 2);
+    }
+}
+
+static void test_record_roundtrip(Position& pos, int depth) {
+    auto bbs = pos.to_bitboards();
+    PackedRecord r = pack_record(bbs, -1234, int8_t(pos.max_ply), -1);
+
+    REQUIRE(unpack_bitboards(r) == bbs);
+    REQUIRE(r.score == -1234);
+    REQUIRE(r.outcome == -1);
+
+    if (depth == 0) {
+        return;
+    }
+
+    MoveList moves = pos.generate_moves();
+    pos.filter_moves(moves);
+
+    for (Move mv : moves) {
+        pos.make_move(mv);
+        test_record_roundtrip(pos, depth-1);
+        pos.unmake_move();
+    }
+}
+
+TEST_CASE("Packed records roundtrip") {
+    const char* fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    };
+
+    for (const char* fen : fens) {
+        auto pos = *Position::parse_fen(fen);
+        test_record_roundtrip(pos, 2);
+    }
+
+    std::string path = "test_records.bin";
+
+    auto pos = *Position::parse_fen(fens[1]);
+    PackedRecord expected = pack_record(pos.to_bitboards(), 57, 3, 1);
+
+    {
+        RecordWriter writer;
+        REQUIRE(writer.open(path));
+
+        {
+            RecordBuffer buffer(writer, 4);
+            for (int i = 0; i < 10; ++i) {
+                buffer.push(expected);
+            }
+        }
+
+        REQUIRE(writer.close());
+    }
+
+    FILE* file = fopen(path.c_str(), "rb");
+    REQUIRE(file);
+    REQUIRE(read_packed_header(file));
+
+    std::vector<PackedRecord> records(16);
+    size_t n = fread(records.data(), sizeof(PackedRecord), records.size(), file);
+    fclose(file);
+    std::remove(path.c_str());
+
+    REQUIRE(n == 10);
+    for (size_t i = 0; i < n; ++i) {
+        REQUIRE(memcmp(&records[i], &expected, sizeof(PackedRecord)) == 0);
+    }
+}
+
+static void check_limits(const TimeManager& tm, double soft, double hard) {
+    REQUIRE(std::abs(tm.soft_limit() - soft) < 1e-9);
+    REQUIRE(std::abs(tm.hard_limit() - hard) < 1e-9);
+}
+
+// 30ms of move overhead come off the clock before any budgeting
+TEST_CASE("Time manager limits for clock states") {
+    // fixed time per move: both limits are the move time
+    check_limits(TimeManager(1.0), 0.97, 0.97);
+
+    // sudden death without increment: a 40th of the clock, the hard limit at four times the optimum
+    check_limits(TimeManager(ClockState { .time_ms = 60000, .increment_ms = 0, .moves_to_go = 0 }), 59.97 / 40 * 0.7, 59.97 / 40 * 4);
+
+    // last move before the time control: the hard limit is capped at 90% of the clock instead of half
+    check_limits(TimeManager(ClockState { .time_ms = 10000, .increment_ms = 0, .moves_to_go = 1 }), 9.97 * 0.7, 9.97 * 0.9);
+
+    // an increment larger than the clock share: the hard limit is capped at half the clock
+    check_limits(TimeManager(ClockState { .time_ms = 10000, .increment_ms = 5000, .moves_to_go = 0 }), (9.97 / 40 + 3.75) * 0.7, 9.97 * 0.5);
+
+    // almost no time left: still a positive budget, never more than what is left
+    TimeManager low(ClockState { .time_ms = 10, .increment_ms = 0, .moves_to_go = 0 });
+    REQUIRE(low.hard_limit() > 0.0);
+    REQUIRE(low.soft_limit() <= low.hard_limit());
+    REQUIRE(low.hard_limit() <= 0.001);
+}
@@ -81,3 +81,134 @@ TEST_CASE("Polyglot - Starting Position (a2a4 b7b5 h2h4 b5b4 c2c4 b4c3 a1a3)") {
 
     REQUIRE(hash == 0x5c3f9b829b279560);
 }
+
+TEST_CASE("Polyglot - Book probe finds legal start position moves") {
+    Position pos = *Position::parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+    std::array<PolyglotEntry, MAX_BOOK_MOVES> entries;
+    size_t n = embedded_book().probe(pos.encode_polyglot(), entries);
+
+    REQUIRE(n > 0);
+
+    for (size_t i = 0; i < n; ++i) {
+        REQUIRE(entries[i].key == pos.encode_polyglot());
+        REQUIRE(pos.is_move_legal(pos.decode_polyglot(entries[i])));
+    }
+
+    // a miss fills nothing
+    REQUIRE(embedded_book().probe(0x0123456789abcdef, entries) == 0);
+}
+
+TEST_CASE("Polyglot - Empty or missing book set never returns a move") {
+    BookSet books;
+    REQUIRE(books.load("<empty>"));
+
+    Position pos = *Position::parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    REQUIRE(!books.probe(pos).has_value());
+    REQUIRE(!books.load("/nonexistent/book.bin"));
+}
+
+static void polyglot_search(int depth, Position& position) {
+    REQUIRE(position.polyglot == position.compute_polyglot());
+
+    if (depth == 0) {
+        return;
+    }
+
+    int my_side = position.to_move;
+    MoveList moves = position.generate_moves();
+
+    for (Move move : moves) {
+        position.make_move(move);
+
+        if (!position.is_checked[my_side]) {
+            polyglot_search(depth - 1, position);
+        }
+
+        position.unmake_move();
+    }
+
+    if (!position.is_checked[my_side]) {
+        position.make_null_move();
+        polyglot_search(depth - 1, position);
+        position.unmake_null_move();
+    }
+
+    REQUIRE(position.polyglot == position.compute_polyglot());
+}
+
+TEST_CASE("Polyglot - incremental key equals compute_polyglot") {
+    Position pos = *Position::parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+    polyglot_search(4, pos);
+}
+
+TEST_CASE("Polyglot - incremental key matches the reference keys after playing the moves") {
+    Position pos = *Position::parse_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+    auto play = [&](const char* uci) {
+        for (Move move : pos.generate_moves()) {
+            if (to_uci_move(move) == uci) {
+                pos.make_move(move);
+                return;
+            }
+        }
+        FAIL(uci);
+    };
+
+    play("e2e4");
+    REQUIRE(pos.encode_polyglot() == 0x823c9b50fd114196);
+    play("d7d5");
+    play("e4e5");
+    play("f7f5");
+    REQUIRE(pos.encode_polyglot() == 0x22a48b5a8e47ff78);
+    play("e1e2");
+    play("e8f7");
+    REQUIRE(pos.encode_polyglot() == 0x00fdd303c946bdd9);
+}
+
+TEST_CASE("Polyglot - moves round trip, castling as king takes rook") {
+    Position pos = *Position::parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+
+    MoveList moves = pos.generate_moves();
+    pos.filter_moves(moves);
+
+    for (Move move : moves) {
+        REQUIRE(pos.decode_polyglot(PolyglotEntry { .key = 0, .move = encode_polyglot_move(move), .weight = 0, .learn = 0 }) == move);
+    }
+
+    std::optional<Move> castle = pos.parse_san("O-O");
+    REQUIRE(castle.has_value());
+    REQUIRE(encode_polyglot_move(*castle) == ((4 << 6) | 7)); // e1h1
+
+    // older books write the king's destination
+    REQUIRE(pos.decode_polyglot(PolyglotEntry { .key = 0, .move = (4 << 6) | 6, .weight = 0, .learn = 0 }) == *castle);
+}
+
+TEST_CASE("Polyglot - SAN parsing") {
+    Position pos = *Position::parse_fen("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+
+    auto uci = [&](std::string_view san) {
+        std::optional<Move> move = pos.parse_san(san);
+        return move ? to_uci_move(*move) : std::string("none");
+    };
+
+    REQUIRE(uci("O-O-O") == "e1c1");
+    REQUIRE(uci("Nxf7") == "e5f7");
+    REQUIRE(uci("dxe6!?") == "d5e6");
+    REQUIRE(uci("Qxf6+") == "f3f6");
+    REQUIRE(uci("Rb1") == "a1b1");
+    REQUIRE(uci("Nb1") == "c3b1");
+    REQUIRE(uci("Bxa6") == "e2a6");
+    REQUIRE(uci("Kd1") == "e1d1");
+    REQUIRE(uci("gxh3") == "g2h3");
+    REQUIRE(uci("Ng4") == "e5g4");
+    REQUIRE(uci("Ng5") == "none");
+
+    pos = *Position::parse_fen("4k3/P7/8/8/8/8/4K3/R6R w - - 0 1");
+
+    REQUIRE(uci("Rd1") == "none"); // ambiguous
+    REQUIRE(uci("Rad1") == "a1d1");
+    REQUIRE(uci("Rhd1") == "h1d1");
+    REQUIRE(uci("a8=Q+") == "a7a8q");
+    REQUIRE(uci("a8N") == "a7a8n");
+}
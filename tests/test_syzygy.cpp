@@ -0,0 +1,219 @@
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include "blunderfish.h"
+
+// KRvK and KQvK tables in tests/syzygy, written by tests/syzygy/make_tables.py
+
+static void init_test_tables() {
+    static int found = tb_init(SYZYGY_TEST_DIR);
+    REQUIRE(found == 2);
+}
+
+static WDLScore probe_wdl(const std::string& fen) {
+    Position pos = *Position::parse_fen(fen);
+    bool success;
+    WDLScore wdl = tb_probe_wdl(pos, &success);
+    REQUIRE(success);
+    return wdl;
+}
+
+static int probe_dtz(const std::string& fen) {
+    Position pos = *Position::parse_fen(fen);
+    bool success;
+    int dtz = tb_probe_dtz(pos, &success);
+    REQUIRE(success);
+    return dtz;
+}
+
+// White king, a white rook or queen and the black king, empty if the side not to move is in check
+static std::optional<Position> make_position(int wk, int piece_sq, char piece, int bk, int to_move) {
+    std::string board(64, ' ');
+    board[size_t(wk)] = 'K';
+    board[size_t(piece_sq)] = piece;
+    board[size_t(bk)] = 'k';
+
+    std::string fen;
+
+    for (int rank = 7; rank >= 0; --rank) {
+        int empty = 0;
+
+        for (int file = 0; file < 8; ++file) {
+            char c = board[size_t(rank * 8 + file)];
+
+            if (c == ' ') {
+                empty++;
+                continue;
+            }
+
+            if (empty) {
+                fen += char('0' + empty);
+                empty = 0;
+            }
+
+            fen += c;
+        }
+
+        if (empty) {
+            fen += char('0' + empty);
+        }
+
+        if (rank) {
+            fen += '/';
+        }
+    }
+
+    fen += to_move == WHITE ? " w - - 0 1" : " b - - 0 1";
+
+    std::optional<Position> pos = Position::parse_fen(fen);
+
+    if (!pos || pos->is_checked[1 - to_move]) {
+        return std::nullopt;
+    }
+
+    return pos;
+}
+
+TEST_CASE("Syzygy - tables are found") {
+    init_test_tables();
+
+    REQUIRE(tb_cardinality() == 3);
+
+    tb_set_probe_limit(2);
+    REQUIRE(tb_cardinality() == 2);
+
+    tb_set_probe_limit(7);
+    REQUIRE(tb_cardinality() == 3);
+}
+
+TEST_CASE("Syzygy - known KRvK and KQvK results") {
+    init_test_tables();
+
+    REQUIRE(probe_wdl("8/8/8/4k3/8/8/8/R3K3 w - - 0 1") == WDL_WIN);
+    REQUIRE(probe_wdl("4k3/8/8/8/8/8/8/3QK3 b - - 0 1") == WDL_LOSS);
+
+    // the king takes the loose rook or queen
+    REQUIRE(probe_wdl("8/8/8/8/8/8/6k1/K6R b - - 0 1") == WDL_DRAW);
+    REQUIRE(probe_wdl("8/8/8/8/8/8/1Q6/k6K b - - 0 1") == WDL_DRAW);
+
+    // stalemate and mate
+    REQUIRE(probe_wdl("k1K5/7R/8/8/8/8/8/8 b - - 0 1") == WDL_DRAW);
+    REQUIRE(probe_wdl("R6k/8/6K1/8/8/8/8/8 b - - 0 1") == WDL_LOSS);
+
+    // black has the rook
+    REQUIRE(probe_wdl("8/8/8/8/8/8/3r4/4k2K w - - 0 1") == WDL_LOSS);
+
+    // without pawns or captures DTZ is the distance to mate
+    REQUIRE(probe_dtz("k7/8/1K6/8/8/8/8/7R w - - 0 1") == 1);
+    REQUIRE(probe_dtz("8/8/8/8/8/8/8/K6k w - - 0 1") == 0);
+    REQUIRE(probe_dtz("8/8/8/8/8/8/3r4/4k2K w - - 0 1") < 0);
+}
+
+TEST_CASE("Syzygy - root filtering keeps only winning moves") {
+    init_test_tables();
+
+    // Rb7 stalemates, everything else wins
+    Position pos = *Position::parse_fen("k7/2K5/8/8/8/8/8/1R6 w - - 0 1");
+    MoveList moves = pos.generate_moves();
+    pos.filter_moves(moves);
+    int legal_count = moves.count;
+
+    bool dtz_ranked;
+    REQUIRE(tb_filter_root_moves(pos, moves, &dtz_ranked));
+    REQUIRE(dtz_ranked);
+    REQUIRE(moves.count > 0);
+    REQUIRE(moves.count < legal_count);
+
+    for (Move m : moves) {
+        pos.make_move(m);
+        bool success;
+        REQUIRE(tb_probe_wdl(pos, &success) == WDL_LOSS);
+        pos.unmake_move();
+    }
+}
+
+// The table values have to be consistent with the values one ply further on,
+// which a wrong index or decoding would break
+TEST_CASE("Syzygy - probes agree with a one-ply search") {
+    init_test_tables();
+
+    for (char piece : { 'R', 'Q' }) {
+        for (int n = 0; n < 64 * 64 * 64; n += 89) {
+            int wk = n / 4096, piece_sq = (n / 64) % 64, bk = n % 64;
+
+            if (wk == piece_sq || wk == bk || piece_sq == bk) {
+                continue;
+            }
+
+            if (std::abs(wk % 8 - bk % 8) <= 1 && std::abs(wk / 8 - bk / 8) <= 1) {
+                continue;
+            }
+
+            for (int to_move : { WHITE, BLACK }) {
+                std::optional<Position> maybe_pos = make_position(wk, piece_sq, piece, bk, to_move);
+
+                if (!maybe_pos) {
+                    continue;
+                }
+
+                Position& pos = *maybe_pos;
+                bool success;
+                int wdl = tb_probe_wdl(pos, &success);
+                REQUIRE(success);
+                int dtz = tb_probe_dtz(pos, &success);
+                REQUIRE(success);
+
+                MoveList moves = pos.generate_moves();
+                pos.filter_moves(moves);
+
+                if (moves.count == 0) {
+                    REQUIRE(wdl == (pos.is_checked[to_move] ? WDL_LOSS : WDL_DRAW));
+                    continue;
+                }
+
+                int best_wdl = WDL_LOSS;
+                int quickest_win = 1000;
+                int longest_loss = 0;
+
+                for (Move m : moves) {
+                    pos.make_move(m);
+
+                    int child_wdl = WDL_DRAW;
+
+                    if (std::popcount(pos.all_pieces()) > 2) {
+                        child_wdl = -tb_probe_wdl(pos, &success);
+                        REQUIRE(success);
+
+                        int child_dtz = tb_probe_dtz(pos, &success);
+                        REQUIRE(success);
+
+                        MoveList replies = pos.generate_moves();
+                        pos.filter_moves(replies);
+
+                        if (child_wdl == WDL_WIN) {
+                            quickest_win = std::min(replies.count == 0 ? 1 : 1 - child_dtz, quickest_win);
+                        }
+                        else if (child_wdl == WDL_LOSS) {
+                            longest_loss = std::max(child_dtz + 1, longest_loss);
+                        }
+                    }
+
+                    pos.unmake_move();
+
+                    best_wdl = std::max(child_wdl, best_wdl);
+                }
+
+                REQUIRE(wdl == best_wdl);
+
+                if (wdl == WDL_WIN) {
+                    REQUIRE(dtz == quickest_win);
+                }
+                else if (wdl == WDL_LOSS) {
+                    REQUIRE(dtz == -longest_loss);
+                }
+                else {
+                    REQUIRE(dtz == 0);
+                }
+            }
+        }
+    }
+}
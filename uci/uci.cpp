@@ -1,6 +1,9 @@
 #include <thread>
 #include <iostream>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include "blunderfish.h"
 
@@ -78,52 +81,112 @@ static std::optional<Move> parse_uci_move(Position* pos, const std::string& move
     return encode_move(from, to, move_type, end_piece, pos->to_move, captured_piece);
 }
 
-static void parse_position(const std::string& line, Position* pos) {
+// What the current position was built from, so that a position command which only appends
+// moves to the previous one (the usual case during a game) doesn't replay the whole game
+struct PositionHistory {
+    std::string base;
+    std::vector<std::string> moves;
+};
+
+static void parse_position(const std::string& line, Position* pos, PositionHistory* history) {
     const char* moves_string = " moves ";
     size_t moves_start = line.find(moves_string);
     std::string pos_part = line.substr(0, moves_start);
     std::string moves_part = (moves_start != std::string::npos) ? line.substr(moves_start + strlen(moves_string)) : "";
 
-    if (pos_part.find("startpos") != std::string::npos) {
-        *pos = *Position::parse_fen(START_FEN);
+    std::vector<std::string> moves;
+
+    std::istringstream ss(moves_part);
+    std::string move;
+
+    while (ss >> move) {
+        moves.push_back(move);
     }
-    else if (pos_part.find("fen") != std::string::npos) {
-        std::string fen = pos_part.substr(pos_part.find("fen") + 4);
-        auto pos_result = Position::parse_fen(fen);
-        if (!pos_result.has_value()) {
-            std::cout << "Invalid FEN " << fen << "\n";
-            return;
-        }
-        *pos = std::move(*pos_result);
+
+    bool extends_previous = pos_part == history->base
+                         && moves.size() >= history->moves.size()
+                         && std::equal(history->moves.begin(), history->moves.end(), moves.begin());
+
+    size_t first_new_move = 0;
+
+    if (extends_previous) {
+        first_new_move = history->moves.size();
     }
     else {
-        std::cout << "Unrecognized position type\n";
-        return;
-    }
+        history->base.clear();
+        history->moves.clear();
+
+        if (pos_part.find("startpos") != std::string::npos) {
+            *pos = *Position::parse_fen(START_FEN);
+        }
+        else if (pos_part.find("fen") != std::string::npos) {
+            std::string fen = pos_part.substr(pos_part.find("fen") + 4);
+            auto pos_result = Position::parse_fen(fen);
+            if (!pos_result.has_value()) {
+                std::cout << "Invalid FEN " + fen + "\n";
+                return;
+            }
+            *pos = std::move(*pos_result);
+        }
+        else {
+            std::cout << "Unrecognized position type\n";
+            return;
+        }
 
-    // parse moves
+        history->base = pos_part;
+    }
 
-    std::istringstream ss(moves_part);
-    std::string move;
+    // apply the new moves
 
-    while (ss >> move) {
-        std::optional<Move> mv_result = parse_uci_move(pos, move);
+    for (size_t i = first_new_move; i < moves.size(); ++i) {
+        std::optional<Move> mv_result = parse_uci_move(pos, moves[i]);
 
         if (!mv_result.has_value()) {
-            std::cout << "Illegal move " << move << "\n";
+            std::cout << "Illegal move " + moves[i] + "\n";
             break;
         }
 
         Move mv = *mv_result;
 
-        if (!pos->is_move_legal_slow(mv)) {
-            std::cout << "Illegal move " << move << "\n";
+        if (!pos->is_move_legal(mv)) {
+            std::cout << "Illegal move " + moves[i] + "\n";
             break;
         }
+
         pos->make_move(mv);
+        history->moves.push_back(moves[i]);
     }
 }
 
+struct SetOption {
+    std::string name;
+    std::string value;
+};
+
+// setoption name <id> [value <x>], both of which may contain spaces
+static std::optional<SetOption> parse_setoption(const std::string& line) {
+    size_t name_start = line.find(" name ");
+
+    if (name_start == std::string::npos) {
+        return std::nullopt;
+    }
+
+    name_start += strlen(" name ");
+    size_t value_start = line.find(" value ", name_start);
+
+    SetOption option;
+
+    if (value_start == std::string::npos) {
+        option.name = line.substr(name_start);
+    }
+    else {
+        option.name = line.substr(name_start, value_start - name_start);
+        option.value = line.substr(value_start + strlen(" value "));
+    }
+
+    return option;
+}
+
 struct GoParams {
     std::optional<int> wtime;
     std::optional<int> btime;
@@ -167,115 +230,389 @@ static GoParams parse_go_command(const std::string& line) {
     return g;
 }
 
-static int allocate_time(int time, int inc) {
-    return time/40 + inc/2;
-}
+// Pondering runs on the opponent's clock, so limits only apply from the ponderhit onwards
+class UCIBudgeter : public TimeManager {
+public:
+    UCIBudgeter(double seconds, int node_limit, bool pondering)
+        : TimeManager(seconds, node_limit), _pondering(pondering)
+    {}
+
+    UCIBudgeter(const ClockState& clock, int node_limit, bool pondering)
+        : TimeManager(clock, node_limit), _pondering(pondering)
+    {}
 
-static int calculate_move_time(const GoParams& p, int to_move) {
-    if (p.infinite) {
-        return INT32_MAX;
+    virtual bool should_exit(Position& pos) const override {
+        return !_pondering && TimeManager::should_exit(pos);
     }
 
-    if (p.movetime) {
-        return *p.movetime;
+    virtual bool should_start_iteration(const IterationInfo& last) override {
+        bool keep_going = TimeManager::should_start_iteration(last); // always update the stability stats
+        return _pondering || keep_going;
     }
 
-    int time = to_move == WHITE ? p.wtime.value_or(0) : p.btime.value_or(0);
-    int inc = to_move == WHITE ? p.winc.value_or(0) : p.binc.value_or(0);
+    // the opponent played the expected move, so the clock starts now
+    void ponderhit() {
+        restart();
+        _pondering = false;
+    }
 
-    if (time == 0) {
-        return INT32_MAX;
+    bool is_pondering() const {
+        return _pondering;
     }
 
-    return allocate_time(time, inc);
+private:
+    std::atomic<bool> _pondering;
+};
+
+static std::unique_ptr<UCIBudgeter> make_budgeter(const GoParams& g, int to_move) {
+    int node_limit = g.nodes.value_or(INT_MAX);
+
+    if (g.movetime) {
+        return std::make_unique<UCIBudgeter>(double(*g.movetime) / 1000.0, node_limit, g.ponder);
+    }
+
+    int time = to_move == WHITE ? g.wtime.value_or(0) : g.btime.value_or(0);
+    int inc  = to_move == WHITE ? g.winc.value_or(0) : g.binc.value_or(0);
+
+    if (g.infinite || time == 0) {
+        return std::make_unique<UCIBudgeter>(double(INT32_MAX), node_limit, g.ponder);
+    }
+
+    ClockState clock = {
+        .time_ms = time,
+        .increment_ms = inc,
+        .moves_to_go = g.movestogo.value_or(0),
+    };
+
+    return std::make_unique<UCIBudgeter>(clock, node_limit, g.ponder);
 }
 
-class UCIBudgeter : public Budgeter {
+// A single long-lived thread that runs searches on position snapshots handed over through a queue,
+// so the stdin loop never touches the position being searched and stays responsive during a search
+class SearchWorker {
 public:
-    UCIBudgeter(int node_count, double seconds)
-        : _nodes(node_count), _seconds(seconds)
-    {}
+    SearchWorker()
+        : _context(std::make_unique<SearchContext>(SearchParameters{}, _should_stop, &null_budgeter))
+    {
+        _thread = std::thread([this]() { run(); });
+    }
 
-    virtual void init() override {
-        _start = Clock::now();
+    ~SearchWorker() {
+        {
+            std::lock_guard lock(_mutex);
+            _quit = true;
+            _should_stop = true;
+        }
+
+        _cv.notify_all();
+        _thread.join();
     }
 
-    virtual bool should_exit(Position& pos) const override {
-        int64_t elapsed_microseconds = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - _start).count();
-        double elapsed_s = double(elapsed_microseconds)/1000000.0;
-        return pos.node_count >= _nodes || elapsed_s >= _seconds;
+    void go(const Position& position, const GoParams& g) {
+        {
+            std::lock_guard lock(_mutex);
+            _should_stop = true; // a new go replaces whatever is running
+
+            for (Job& job : _jobs) {
+                job.stopped = true;
+            }
+
+            _jobs.push_back({
+                .type = JOB_SEARCH,
+                .position = position,
+                .depth = g.depth.value_or(40),
+                .budgeter = make_budgeter(g, position.to_move),
+                .stopped = false,
+            });
+        }
+
+        _cv.notify_all();
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(_mutex);
+            _should_stop = true;
+
+            // searches that haven't started yet still owe a bestmove, they'll just return it straight away
+            for (Job& job : _jobs) {
+                job.stopped = true;
+            }
+        }
+
+        _cv.notify_all();
+    }
+
+    void ponderhit() {
+        {
+            std::lock_guard lock(_mutex);
+
+            if (_current_budgeter) {
+                _current_budgeter->ponderhit();
+            }
+
+            for (Job& job : _jobs) {
+                if (job.budgeter) {
+                    job.budgeter->ponderhit();
+                }
+            }
+        }
+
+        _cv.notify_all();
+    }
+
+    void new_game() {
+        {
+            std::lock_guard lock(_mutex);
+            _jobs.push_back({ .type = JOB_NEW_GAME });
+        }
+
+        _cv.notify_all();
+    }
+
+    void set_books(const std::string& paths) {
+        {
+            std::lock_guard lock(_mutex);
+            _jobs.push_back({ .type = JOB_SET_BOOKS, .book_paths = paths });
+        }
+
+        _cv.notify_all();
+    }
+
+    // tablebases are swapped between searches, never under a running one
+    void set_tablebases(const std::string& paths) {
+        {
+            std::lock_guard lock(_mutex);
+            _jobs.push_back({ .type = JOB_SET_TABLEBASES, .tb_paths = paths });
+        }
+
+        _cv.notify_all();
+    }
+
+    void set_probe_limit(int pieces) {
+        {
+            std::lock_guard lock(_mutex);
+            _jobs.push_back({ .type = JOB_SET_PROBE_LIMIT, .probe_limit = pieces });
+        }
+
+        _cv.notify_all();
+    }
+
+    void set_multi_pv(int multi_pv) {
+        _multi_pv = multi_pv;
+    }
+
+    // picked up by the next search
+    void set_search_parameter(const SearchParameterInfo& info, float value) {
+        std::lock_guard lock(_mutex);
+        info.set(_params, std::clamp(value, info.lo, info.hi));
     }
 
 private:
-    int _nodes;
-    double _seconds;
-    TimePoint _start;
+    enum JobType {
+        JOB_SEARCH,
+        JOB_NEW_GAME,
+        JOB_SET_BOOKS,
+        JOB_SET_TABLEBASES,
+        JOB_SET_PROBE_LIMIT
+    };
+
+    struct Job {
+        JobType type = JOB_SEARCH;
+        Position position = {};
+        int depth = 0;
+        std::unique_ptr<UCIBudgeter> budgeter = nullptr;
+        bool stopped = false;
+        std::string book_paths = {};
+        std::string tb_paths = {};
+        int probe_limit = 0;
+    };
+
+    void run() {
+        while (true) {
+            Job job;
+
+            {
+                std::unique_lock lock(_mutex);
+                _cv.wait(lock, [this]() { return _quit || !_jobs.empty(); });
+
+                if (_quit) {
+                    return;
+                }
+
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+
+                if (job.type == JOB_SEARCH) {
+                    _should_stop = job.stopped;
+                    _current_budgeter = job.budgeter.get();
+                    _context->params = _params;
+                }
+            }
+
+            if (job.type == JOB_NEW_GAME) {
+                _context->clear();
+                _books.new_game();
+                continue;
+            }
+
+            if (job.type == JOB_SET_BOOKS) {
+                if (!_books.load(job.book_paths)) {
+                    std::cout << std::format("info string Failed to open book {}\n", job.book_paths);
+                }
+                continue;
+            }
+
+            if (job.type == JOB_SET_TABLEBASES) {
+                int count = tb_init(job.tb_paths);
+                std::cout << std::format("info string Found {} tablebases\n", count);
+                continue;
+            }
+
+            if (job.type == JOB_SET_PROBE_LIMIT) {
+                tb_set_probe_limit(job.probe_limit);
+                continue;
+            }
+
+            _context->budgeter = job.budgeter.get();
+            _context->multi_pv = _multi_pv;
+
+            Move ponder_move = NULL_MOVE;
+            std::optional<Move> book_move = _books.probe(job.position);
+            Move move = book_move ? *book_move : job.position.best_move(*_context, job.depth, true, nullptr, &ponder_move);
+
+            {
+                std::unique_lock lock(_mutex);
+
+                // the GUI expects no bestmove while pondering, even if the search finished early
+                _cv.wait(lock, [&]() { return !job.budgeter->is_pondering() || _should_stop; });
+
+                _current_budgeter = nullptr;
+            }
+
+            _context->budgeter = &null_budgeter;
+
+            std::string bestmove = "bestmove " + to_uci_move(move);
+
+            if (ponder_move != NULL_MOVE) {
+                bestmove += " ponder " + to_uci_move(ponder_move);
+            }
+
+            std::cout << bestmove + "\n";
+        }
+    }
+
+    std::atomic<bool> _should_stop = false;
+    std::atomic<int> _multi_pv = 1;
+    SearchParameters _params = {};
+
+    // kept between searches so that pondering and earlier moves warm up the TT
+    std::unique_ptr<SearchContext> _context;
+
+    // only touched by the worker thread, changes arrive as jobs
+    BookSet _books;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Job> _jobs;
+    UCIBudgeter* _current_budgeter = nullptr;
+    bool _quit = false;
+
+    std::thread _thread;
 };
 
 int main() {
-    std::ios::sync_with_stdio(false);
+    // output comes from both the stdin loop and the search thread, keep cout synced with stdio so
+    // each write stays intact
     std::cout.setf(std::ios::unitbuf);
 
     std::string line;
-    std::thread thread;
-    std::atomic<bool> should_stop = false;
 
     Position position = *Position::parse_fen(START_FEN);
+    PositionHistory position_history;
+
+    SearchWorker worker;
     
     while (std::getline(std::cin, line)) {
         if (line == "uci") {
-            std::cout << "id name blunderfish\n";
-            std::cout << "id author jerikki\n";
-            std::cout << "uciok\n";
+            std::cout << "id name blunderfish\n"
+                         "id author jerikki\n"
+                         "option name Ponder type check default false\n"
+                         "option name MultiPV type spin default 1 min 1 max 256\n"
+                         "option name SyzygyPath type string default <empty>\n"
+                         "option name SyzygyProbeLimit type spin default 7 min 0 max 7\n"
+                         "option name BookFile type string default <empty>\n";
+
+            // search parameters, floats go through string options since spin only takes integers
+            SearchParameters defaults;
+            std::string options;
+
+            for (const SearchParameterInfo& info : search_parameter_table()) {
+                if (info.is_int) {
+                    options += std::format("option name {} type spin default {} min {} max {}\n", info.name, info.get(defaults), info.lo, info.hi);
+                }
+                else {
+                    options += std::format("option name {} type string default {}\n", info.name, info.get(defaults));
+                }
+            }
+
+            std::cout << options + "uciok\n";
         }
         else if (line == "isready") {
             std::cout << "readyok\n";
         }
         else if (line == "ucinewgame") {
             position = *Position::parse_fen(START_FEN);
+            position_history = {};
+            worker.new_game();
+        }
+        else if (line.starts_with("setoption")) {
+            std::optional<SetOption> option = parse_setoption(line);
+
+            if (!option.has_value()) {
+                std::cout << "Invalid setoption " + line + "\n";
+            }
+            else if (option->name == "SyzygyPath") {
+                worker.set_tablebases(option->value);
+            }
+            else if (option->name == "Ponder") {
+                // nothing to configure, we ponder whenever the GUI sends go ponder
+            }
+            else if (option->name == "MultiPV") {
+                worker.set_multi_pv(std::clamp(atoi(option->value.c_str()), 1, 256));
+            }
+            else if (option->name == "BookFile") {
+                worker.set_books(option->value);
+            }
+            else if (option->name == "SyzygyProbeLimit") {
+                worker.set_probe_limit(atoi(option->value.c_str()));
+            }
+            else if (const SearchParameterInfo* info = find_search_parameter(option->name)) {
+                worker.set_search_parameter(*info, float(atof(option->value.c_str())));
+            }
+            else {
+                std::cout << "Unrecognized option " + option->name + "\n";
+            }
         }
         else if (line.starts_with("position")) {
-            parse_position(line, &position);
+            parse_position(line, &position, &position_history);
         }
         else if (line == "quit") {
-            should_stop = true;
-            if (thread.joinable()) {
-                thread.join();
-            }
             return 0;
         }
         else if (line.starts_with("go")) {
-            should_stop = true;
-            if (thread.joinable()) {
-                thread.join();
-            }
-
-            GoParams g = parse_go_command(line);
-
-            int time_ms = calculate_move_time(g, position.to_move);
-            double time_s = double(time_ms)/1000.0*0.95;
-
-            int node_budget = g.nodes.value_or(INT_MAX);
-            int depth = g.depth.value_or(40);
-
-            should_stop = false;
-            
-            thread = std::thread([&position, depth, &should_stop, time_s, node_budget](){
-                UCIBudgeter budgeter(node_budget, time_s);
-                Move move = position.best_move(depth, should_stop, &budgeter, {}, true);
-                std::cout << "bestmove " << to_uci_move(move) << "\n";
-            });
+            worker.go(position, parse_go_command(line));
+        }
+        else if (line == "ponderhit") {
+            worker.ponderhit();
         }
         else if (line == "stop") {
-            should_stop = true;
-            if (thread.joinable()) {
-                thread.join();
-            }
+            worker.stop();
         }
         else {
-            std::cout << "Unrecognized command" << line << "\n";
+            std::cout << "Unrecognized command" + line + "\n";
         }
     }
 
     return 1;
-}
\ No newline at end of file
+}